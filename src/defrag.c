@@ -0,0 +1,756 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Needed for 'copy_file_range' */
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "include/bytearray.h"
+#include "include/disk.h"
+#include "include/fat12.h"
+#include "include/tree.h"
+#include "include/util.h"
+#include "include/defrag.h"
+
+/*
+ * Suffix of the temporary file where the defragmented image is written.
+ */
+#define TMP_SUFFIX ".defrag.tmp"
+
+/*
+ * Size of the buffer used for copying data when the kernel can't do it.
+ */
+#define BUFFERED_COPY_SIZE (1024 * 1024)
+
+/*
+ * Cluster chain of a file or directory, in the order they were found.
+ */
+typedef struct {
+    uint16_t first_cluster;
+    bool is_dir;
+} ChainRef;
+
+/*
+ * State of 'defrag_image', shared by the tree visitor.
+ */
+typedef struct {
+    const Disk* disk;
+    const ExtendedBPB* ebpb;
+    ByteArray fat;
+
+    /* Chains found by the tree walk, in pre-order */
+    ChainRef* chains;
+    size_t chain_count;
+    size_t chain_capacity;
+
+    /*
+     * Relocation plan. Both arrays are indexed by cluster number, and contain
+     * zero for the clusters that are not used.
+     */
+    size_t entry_count; /* Number of FAT entries, including the reserved two */
+    uint16_t* remap;    /* Old cluster -> new cluster */
+    uint16_t* origin;   /* New cluster -> old cluster */
+    bool* is_dir;       /* Indexed by the new cluster */
+    bool* pinned;       /* Bad and lost clusters, which are not moved */
+    uint16_t end_cluster;
+
+    size_t fragments_before;
+    size_t fragments_after;
+    size_t used_clusters;
+    size_t moved_clusters;
+    size_t lost_clusters;
+
+    /* Output */
+    int tmp_fd;
+    bool use_kernel_copy;
+    void* buffer;
+} Defrag;
+
+/*----------------------------------------------------------------------------*/
+/* Planning */
+
+static bool defrag_visit(void* ctx,
+                         const char* path,
+                         const DirectoryEntry* entry) {
+    (void)path;
+    Defrag* defrag = ctx;
+
+    /* Empty files don't have a chain */
+    if (!fat12_is_data_cluster(entry->first_cluster_low))
+        return true;
+
+    if (defrag->chain_count >= defrag->chain_capacity) {
+        defrag->chain_capacity =
+          (defrag->chain_capacity == 0) ? 64 : defrag->chain_capacity * 2;
+        ChainRef* new_chains =
+          realloc(defrag->chains, defrag->chain_capacity * sizeof(ChainRef));
+        if (new_chains == NULL)
+            return false;
+        defrag->chains = new_chains;
+    }
+
+    ChainRef* chain      = &defrag->chains[defrag->chain_count++];
+    chain->first_cluster = entry->first_cluster_low;
+    chain->is_dir        = (entry->attributes & ATTR_DIRECTORY) != 0;
+    return true;
+}
+
+/*
+ * Pin the clusters that must stay where they are: the bad clusters, and the
+ * lost clusters, which are allocated in the FAT but don't belong to any chain
+ * of the tree. Lost clusters might still contain data that can be recovered,
+ * so they are kept instead of being freed.
+ *
+ * Also checks that the chains are valid, and that no cluster is used by more
+ * than one of them (including cycles).
+ */
+static bool pin_clusters(Defrag* defrag) {
+    const size_t entry_count = defrag->entry_count;
+
+    bool* reachable = calloc(entry_count, sizeof(bool));
+    if (reachable == NULL)
+        return false;
+
+    bool success = true;
+    for (size_t i = 0; success && i < defrag->chain_count; i++) {
+        for (uint16_t cluster = defrag->chains[i].first_cluster;
+             fat12_is_data_cluster(cluster);
+             cluster = fat12_get_linked_cluster(defrag->fat, cluster)) {
+            if (cluster >= entry_count) {
+                ERR("Invalid cluster number: %u", cluster);
+                success = false;
+                break;
+            }
+
+            if (reachable[cluster]) {
+                ERR("Cluster %u is used by more than one chain, the volume "
+                    "should be repaired first.",
+                    cluster);
+                success = false;
+                break;
+            }
+
+            reachable[cluster] = true;
+        }
+    }
+
+    for (size_t i = 2; success && i < entry_count; i++) {
+        const uint16_t value =
+          fat12_get_linked_cluster(defrag->fat, (uint16_t)i);
+        if (value == FAT12_CLUSTER_BAD) {
+            defrag->pinned[i] = true;
+        } else if (value != FAT12_CLUSTER_FREE && !reachable[i]) {
+            defrag->pinned[i] = true;
+            defrag->lost_clusters++;
+        }
+    }
+
+    free(reachable);
+    return success;
+}
+
+/*
+ * Assign new clusters to every chain, in the order they were found by the tree
+ * walk. Pinned clusters are never used. Counts the fragments (i.e. runs of
+ * contiguous clusters) of the chains before and after the relocation.
+ *
+ * The chains must have been checked by 'pin_clusters'.
+ */
+static bool plan_relocation(Defrag* defrag) {
+    const size_t entry_count = defrag->entry_count;
+    uint16_t next            = 2;
+
+    for (size_t i = 0; i < defrag->chain_count; i++) {
+        const ChainRef* chain = &defrag->chains[i];
+
+        uint16_t prev_old = 0;
+        uint16_t prev_new = 0;
+        for (uint16_t cluster = chain->first_cluster;
+             fat12_is_data_cluster(cluster);
+             cluster = fat12_get_linked_cluster(defrag->fat, cluster)) {
+            while (next < entry_count && defrag->pinned[next])
+                next++;
+            if (next >= entry_count) {
+                ERR("Not enough free clusters for the relocation.");
+                return false;
+            }
+
+            defrag->remap[cluster] = next;
+            defrag->origin[next]   = cluster;
+            defrag->is_dir[next]   = chain->is_dir;
+
+            if (prev_old == 0 || cluster != prev_old + 1)
+                defrag->fragments_before++;
+            if (prev_new == 0 || next != prev_new + 1)
+                defrag->fragments_after++;
+            if (cluster != next)
+                defrag->moved_clusters++;
+            defrag->used_clusters++;
+
+            prev_old = cluster;
+            prev_new = next;
+            next++;
+        }
+    }
+
+    defrag->end_cluster = next;
+    return true;
+}
+
+/*
+ * Build the FAT of the defragmented volume into 'dst', which must have the same
+ * size as the original. The reserved entries and the pinned clusters are kept.
+ */
+static void build_fat(const Defrag* defrag, ByteArray dst) {
+    memcpy(dst.data, defrag->fat.data, dst.size);
+
+    for (size_t i = 2; i < defrag->entry_count; i++) {
+        const uint16_t cluster = (uint16_t)i;
+        if (!defrag->pinned[cluster]) {
+            fat12_set_linked_cluster(dst, cluster, FAT12_CLUSTER_FREE);
+            continue;
+        }
+
+        /* Lost clusters linked to a moved cluster end their chain there */
+        const uint16_t old = fat12_get_linked_cluster(defrag->fat, cluster);
+        if (fat12_is_data_cluster(old) &&
+            (old >= defrag->entry_count || !defrag->pinned[old]))
+            fat12_set_linked_cluster(dst, cluster, FAT12_CLUSTER_EOC);
+    }
+
+    for (uint16_t cluster = 2; cluster < defrag->end_cluster; cluster++) {
+        const uint16_t old_cluster = defrag->origin[cluster];
+        if (old_cluster == 0)
+            continue;
+
+        /* End-of-chain markers are kept as they were */
+        const uint16_t old_next =
+          fat12_get_linked_cluster(defrag->fat, old_cluster);
+        fat12_set_linked_cluster(dst,
+                                 cluster,
+                                 fat12_is_data_cluster(old_next)
+                                   ? defrag->remap[old_next]
+                                   : old_next);
+    }
+}
+
+/*
+ * Update the first cluster of the entries in the specified directory, including
+ * the '.' and '..' entries.
+ */
+static void remap_directory(const Defrag* defrag,
+                            DirectoryEntry* entries,
+                            size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        DirectoryEntry* entry = &entries[i];
+        if ((uint8_t)entry->name[0] == ENTRY_FREE)
+            break;
+        if ((uint8_t)entry->name[0] == ENTRY_DELETED ||
+            entry->attributes == ATTR_LONG_NAME ||
+            (entry->attributes & ATTR_VOLUME_ID) != 0)
+            continue;
+
+        const uint16_t cluster = entry->first_cluster_low;
+        if (fat12_is_data_cluster(cluster) && cluster < defrag->entry_count &&
+            defrag->remap[cluster] != 0)
+            entry->first_cluster_low = defrag->remap[cluster];
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/* Writing */
+
+static bool pread_all(int fd, void* dst, size_t size, uint64_t offset) {
+    char* ptr = dst;
+    while (size > 0) {
+        const ssize_t result = pread(fd, ptr, size, (off_t)offset);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            return false;
+
+        ptr += result;
+        size -= (size_t)result;
+        offset += (uint64_t)result;
+    }
+    return true;
+}
+
+static bool pwrite_all(int fd, const void* src, size_t size, uint64_t offset) {
+    const char* ptr = src;
+    while (size > 0) {
+        const ssize_t result = pwrite(fd, ptr, size, (off_t)offset);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        ptr += result;
+        size -= (size_t)result;
+        offset += (uint64_t)result;
+    }
+    return true;
+}
+
+/*
+ * Copy 'size' bytes between the specified offsets of the original image and of
+ * the temporary file. The kernel is used when possible, so the data doesn't go
+ * through user space.
+ */
+static bool copy_range(Defrag* defrag,
+                       uint64_t src_offset,
+                       uint64_t dst_offset,
+                       uint64_t size) {
+    while (size > 0) {
+        if (defrag->use_kernel_copy) {
+            loff_t in_off  = (loff_t)src_offset;
+            loff_t out_off = (loff_t)dst_offset;
+            const ssize_t copied =
+              copy_file_range(defrag->disk->fd,
+                              &in_off,
+                              defrag->tmp_fd,
+                              &out_off,
+                              size,
+                              0);
+            if (copied < 0 && errno == EINTR)
+                continue;
+            if (copied <= 0) {
+                /* Not supported by these files, use buffered copies */
+                defrag->use_kernel_copy = false;
+                continue;
+            }
+
+            src_offset += (uint64_t)copied;
+            dst_offset += (uint64_t)copied;
+            size -= (uint64_t)copied;
+            continue;
+        }
+
+        const size_t chunk =
+          (size < BUFFERED_COPY_SIZE) ? (size_t)size : BUFFERED_COPY_SIZE;
+        if (!pread_all(defrag->disk->fd, defrag->buffer, chunk, src_offset) ||
+            !pwrite_all(defrag->tmp_fd, defrag->buffer, chunk, dst_offset))
+            return false;
+
+        src_offset += chunk;
+        dst_offset += chunk;
+        size -= chunk;
+    }
+
+    return true;
+}
+
+/*
+ * Return the offset of the specified cluster in the image file.
+ */
+static inline uint64_t get_cluster_offset(const Defrag* defrag,
+                                          uint16_t cluster) {
+    return defrag->disk->offset + (uint64_t)get_cluster_lba(defrag->ebpb,
+                                                            cluster) *
+                                    defrag->ebpb->bytes_per_sector;
+}
+
+/*
+ * Write the relocated data region into the temporary file. Runs of clusters
+ * that stay contiguous are copied with a single call, and the clusters of
+ * directories are updated with their new cluster numbers.
+ */
+static bool write_data_region(Defrag* defrag) {
+    const ExtendedBPB* ebpb    = defrag->ebpb;
+    const size_t cluster_bytes =
+      (size_t)ebpb->bytes_per_sector * ebpb->sectors_per_cluster;
+
+    uint16_t cluster = 2;
+    while (cluster < defrag->end_cluster) {
+        const uint16_t old_cluster = defrag->origin[cluster];
+        if (old_cluster == 0) {
+            cluster++;
+            continue;
+        }
+
+        if (defrag->is_dir[cluster]) {
+            DirectoryEntry* entries = defrag->buffer;
+            if (!pread_all(defrag->disk->fd,
+                           entries,
+                           cluster_bytes,
+                           get_cluster_offset(defrag, old_cluster)))
+                return false;
+
+            remap_directory(defrag,
+                            entries,
+                            cluster_bytes / sizeof(DirectoryEntry));
+            if (!pwrite_all(defrag->tmp_fd,
+                            entries,
+                            cluster_bytes,
+                            get_cluster_offset(defrag, cluster)))
+                return false;
+
+            cluster++;
+            continue;
+        }
+
+        /* Find the end of the run of file clusters that were contiguous */
+        uint16_t run = 1;
+        while (cluster + run < defrag->end_cluster &&
+               !defrag->is_dir[cluster + run] &&
+               defrag->origin[cluster + run] != 0 &&
+               defrag->origin[cluster + run] == old_cluster + run)
+            run++;
+
+        if (!copy_range(defrag,
+                        get_cluster_offset(defrag, old_cluster),
+                        get_cluster_offset(defrag, cluster),
+                        (uint64_t)run * cluster_bytes))
+            return false;
+
+        cluster += run;
+    }
+
+    return true;
+}
+
+/*
+ * Return true if the specified cluster is lost, see 'pin_clusters'.
+ */
+static inline bool is_lost_cluster(const Defrag* defrag, size_t cluster) {
+    return defrag->pinned[cluster] &&
+           fat12_get_linked_cluster(defrag->fat, (uint16_t)cluster) !=
+             FAT12_CLUSTER_BAD;
+}
+
+/*
+ * Copy the lost clusters into the same place of the temporary file, in runs of
+ * contiguous clusters.
+ */
+static bool write_lost_clusters(Defrag* defrag) {
+    const ExtendedBPB* ebpb    = defrag->ebpb;
+    const size_t cluster_bytes =
+      (size_t)ebpb->bytes_per_sector * ebpb->sectors_per_cluster;
+
+    size_t cluster = 2;
+    while (cluster < defrag->entry_count) {
+        if (!is_lost_cluster(defrag, cluster)) {
+            cluster++;
+            continue;
+        }
+
+        size_t run = 1;
+        while (cluster + run < defrag->entry_count &&
+               is_lost_cluster(defrag, cluster + run))
+            run++;
+
+        const uint64_t offset = get_cluster_offset(defrag, (uint16_t)cluster);
+        if (!copy_range(defrag, offset, offset, (uint64_t)run * cluster_bytes))
+            return false;
+
+        cluster += run;
+    }
+
+    return true;
+}
+
+/*
+ * Write the root directory and the FAT copies of the defragmented volume into
+ * the temporary file.
+ */
+static bool write_metadata(Defrag* defrag) {
+    const ExtendedBPB* ebpb = defrag->ebpb;
+    const uint64_t base     = defrag->disk->offset;
+
+    DirectoryEntry* rootdir = read_root_directory(defrag->disk, ebpb);
+    if (rootdir == NULL)
+        return false;
+
+    remap_directory(defrag, rootdir, ebpb->dir_entries_count);
+    bool success =
+      pwrite_all(defrag->tmp_fd,
+                 rootdir,
+                 ebpb->dir_entries_count * sizeof(DirectoryEntry),
+                 base + (uint64_t)get_rootdir_start(ebpb) *
+                          ebpb->bytes_per_sector);
+    free(rootdir);
+
+    ByteArray new_fat;
+    new_fat.size = defrag->fat.size;
+    new_fat.data = malloc(new_fat.size);
+    if (new_fat.data == NULL)
+        return false;
+    build_fat(defrag, new_fat);
+
+    /* Every copy of the FAT is replaced with the new one */
+    for (uint8_t i = 0; success && i < ebpb->fat_count; i++) {
+        const uint64_t lba =
+          ebpb->reserved_sectors + (uint64_t)i * ebpb->sectors_per_fat;
+        success = pwrite_all(defrag->tmp_fd,
+                             new_fat.data,
+                             new_fat.size,
+                             base + lba * ebpb->bytes_per_sector);
+    }
+
+    free(new_fat.data);
+    return success;
+}
+
+/*
+ * Sync the directory containing the specified path, so a rename inside it is
+ * persisted.
+ */
+static bool sync_parent_dir(const char* path) {
+    const char* slash = strrchr(path, '/');
+
+    char* dir_path;
+    if (slash == NULL) {
+        dir_path = strdup(".");
+    } else {
+        const size_t len = (slash == path) ? 1 : (size_t)(slash - path);
+        dir_path         = malloc(len + 1);
+        if (dir_path != NULL) {
+            memcpy(dir_path, path, len);
+            dir_path[len] = '\0';
+        }
+    }
+    if (dir_path == NULL)
+        return false;
+
+    const int fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+    free(dir_path);
+    if (fd < 0)
+        return false;
+
+    const bool success = (fsync(fd) == 0);
+    close(fd);
+    return success;
+}
+
+/*
+ * Check that the image can be replaced by renaming a new file over it: it must
+ * be a regular file, not a symbolic link, without other hard links, and it must
+ * be the file that was opened.
+ */
+static bool is_replaceable_image(const Disk* disk, const char* diskimg_path) {
+    struct stat path_st, fd_st;
+    if (lstat(diskimg_path, &path_st) != 0 || fstat(disk->fd, &fd_st) != 0) {
+        ERR("Error reading '%s': %s", diskimg_path, strerror(errno));
+        return false;
+    }
+
+    if (!S_ISREG(path_st.st_mode)) {
+        ERR("Only regular files can be defragmented, not devices or symbolic "
+            "links.");
+        return false;
+    }
+
+    if (path_st.st_nlink != 1) {
+        ERR("Images with more than one hard link can't be defragmented.");
+        return false;
+    }
+
+    if (path_st.st_dev != fd_st.st_dev || path_st.st_ino != fd_st.st_ino) {
+        ERR("The image '%s' was replaced while it was open.", diskimg_path);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Write the defragmented image into a temporary file, and replace the original
+ * with it. The original image is not modified, so an interrupted run leaves it
+ * intact.
+ *
+ * The temporary file is built in this order: the data outside of the data
+ * region (including other partitions) is copied as-is, the relocated clusters
+ * are copied in large runs, the lost clusters are copied to the same place, and
+ * then the root directory and the FATs are rewritten. The file is synced before
+ * the rename, and the directory after it.
+ */
+static bool write_defragmented(Defrag* defrag, const char* diskimg_path) {
+    const ExtendedBPB* ebpb = defrag->ebpb;
+
+    struct stat st;
+    if (fstat(defrag->disk->fd, &st) != 0)
+        return false;
+
+    const size_t path_len = strlen(diskimg_path);
+    char* tmp_path        = malloc(path_len + STRLEN(TMP_SUFFIX) + 1);
+    if (tmp_path == NULL)
+        return false;
+    memcpy(tmp_path, diskimg_path, path_len);
+    memcpy(&tmp_path[path_len], TMP_SUFFIX, STRLEN(TMP_SUFFIX) + 1);
+
+    defrag->tmp_fd =
+      open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, st.st_mode & 0777);
+    if (defrag->tmp_fd < 0) {
+        ERR("Error opening '%s': %s", tmp_path, strerror(errno));
+        free(tmp_path);
+        return false;
+    }
+
+    /* Keep the owner and the permissions, which are not affected by umask */
+    if (fchown(defrag->tmp_fd, st.st_uid, st.st_gid) != 0 ||
+        fchmod(defrag->tmp_fd, st.st_mode & 07777) != 0) {
+        ERR("Error keeping the owner of '%s': %s",
+            diskimg_path,
+            strerror(errno));
+        close(defrag->tmp_fd);
+        unlink(tmp_path);
+        free(tmp_path);
+        return false;
+    }
+
+    /* The free clusters are left as holes, which read as zeros */
+    const uint64_t file_size = (uint64_t)st.st_size;
+    const uint64_t data_start =
+      defrag->disk->offset +
+      (uint64_t)get_data_region_start(ebpb) * ebpb->bytes_per_sector;
+    const uint64_t data_end =
+      data_start + (uint64_t)(defrag->entry_count - 2) *
+                     ebpb->sectors_per_cluster * ebpb->bytes_per_sector;
+
+    bool success = ftruncate(defrag->tmp_fd, (off_t)file_size) == 0 &&
+                   copy_range(defrag, 0, 0, data_start) &&
+                   copy_range(defrag,
+                              data_end,
+                              data_end,
+                              (file_size > data_end) ? file_size - data_end
+                                                     : 0) &&
+                   write_data_region(defrag) && write_lost_clusters(defrag) &&
+                   write_metadata(defrag) &&
+                   fsync(defrag->tmp_fd) == 0;
+
+    if (close(defrag->tmp_fd) != 0)
+        success = false;
+
+    if (success && rename(tmp_path, diskimg_path) != 0) {
+        ERR("Error replacing '%s': %s", diskimg_path, strerror(errno));
+        success = false;
+    }
+
+    if (success)
+        success = sync_parent_dir(diskimg_path);
+    else
+        unlink(tmp_path);
+
+    free(tmp_path);
+    return success;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Main function */
+
+bool defrag_image(FILE* out,
+                  const char* diskimg_path,
+                  const Disk* volume,
+                  bool dry_run) {
+    if (!dry_run && volume->backend != NULL) {
+        ERR("Only uncompressed images opened without '--direct' can be "
+            "defragmented.");
+        return false;
+    }
+
+    if (!dry_run && !is_replaceable_image(volume, diskimg_path))
+        return false;
+
+    BootSector* boot_sector = read_boot_sector(volume);
+    if (boot_sector == NULL)
+        return false;
+
+    Defrag defrag = {
+        .disk            = volume,
+        .ebpb            = &boot_sector->ebpb,
+        .entry_count     = get_cluster_count(&boot_sector->ebpb) + 2,
+        .tmp_fd          = -1,
+        .use_kernel_copy = true,
+    };
+
+    bool success = false;
+    if (!read_fat(&defrag.fat, volume, defrag.ebpb))
+        goto done;
+
+    const size_t cluster_bytes = (size_t)defrag.ebpb->bytes_per_sector *
+                                 defrag.ebpb->sectors_per_cluster;
+
+    defrag.remap  = calloc(defrag.entry_count, sizeof(uint16_t));
+    defrag.origin = calloc(defrag.entry_count, sizeof(uint16_t));
+    defrag.is_dir = calloc(defrag.entry_count, sizeof(bool));
+    defrag.pinned = calloc(defrag.entry_count, sizeof(bool));
+    defrag.buffer = malloc((cluster_bytes > BUFFERED_COPY_SIZE)
+                             ? cluster_bytes
+                             : BUFFERED_COPY_SIZE);
+    if (defrag.remap == NULL || defrag.origin == NULL ||
+        defrag.is_dir == NULL || defrag.pinned == NULL ||
+        defrag.buffer == NULL)
+        goto done;
+
+    /*
+     * If the walk can't reach every directory, the chains it didn't find would
+     * be freed while their entries still point to them, so nothing is written.
+     */
+    if (!tree_walk(volume, defrag.ebpb, defrag.fat, defrag_visit, &defrag)) {
+        ERR("Could not read the whole directory tree, the image was not "
+            "modified.");
+        goto done;
+    }
+
+    if (!pin_clusters(&defrag) || !plan_relocation(&defrag))
+        goto done;
+
+    fprintf(out,
+            "Fragments: %zu before, %zu after (%zu files and directories).\n"
+            "Clusters to move: %zu of %zu.\n",
+            defrag.fragments_before,
+            defrag.fragments_after,
+            defrag.chain_count,
+            defrag.moved_clusters,
+            defrag.used_clusters);
+    if (defrag.lost_clusters > 0)
+        fprintf(out,
+                "Lost clusters kept in place: %zu (allocated, but not used by "
+                "any file).\n",
+                defrag.lost_clusters);
+
+    if (dry_run || defrag.moved_clusters == 0) {
+        success = true;
+        goto done;
+    }
+
+    success = write_defragmented(&defrag, diskimg_path);
+
+done:
+    free(defrag.buffer);
+    free(defrag.pinned);
+    free(defrag.is_dir);
+    free(defrag.origin);
+    free(defrag.remap);
+    free(defrag.chains);
+    free(defrag.fat.data);
+    free(boot_sector);
+    return success;
+}
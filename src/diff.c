@@ -0,0 +1,792 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h> /* FILE */
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/bytearray.h"
+#include "include/disk.h"
+#include "include/fat12.h"
+#include "include/tree.h"
+#include "include/util.h"
+#include "include/diff.h"
+
+/*
+ * Entry in the directory tree of one of the compared volumes.
+ */
+typedef struct {
+    char* path;
+    DirectoryEntry entry;
+
+    /* Hash of the file contents, only calculated when needed */
+    bool has_hash;
+    uint64_t hash;
+
+    /* Used when pairing deleted and added files */
+    bool matched;
+} DiffEntry;
+
+/*
+ * Dynamic array of 'DiffEntry' structures.
+ */
+typedef struct {
+    DiffEntry* arr;
+    size_t size;
+    size_t capacity;
+} DiffList;
+
+/*
+ * Volume being compared.
+ */
+typedef struct {
+    const Disk* disk;
+    BootSector* boot_sector;
+    ByteArray fat;
+    DiffList entries;
+} DiffVolume;
+
+/*
+ * Single line of the output. See the comment in 'diff.h' for the possible
+ * values of 'kind'.
+ */
+typedef struct {
+    char kind;
+    bool is_dir;
+    char* path;
+    char* new_path; /* Only used by 'R' */
+} DiffChange;
+
+/*
+ * Dynamic array of 'DiffChange' structures.
+ */
+typedef struct {
+    DiffChange* arr;
+    size_t size;
+    size_t capacity;
+} ChangeList;
+
+/*
+ * Directory that was renamed or moved, detected because it still starts in the
+ * same cluster.
+ */
+typedef struct {
+    char* old_path;
+    char* new_path;
+} DirRename;
+
+/*----------------------------------------------------------------------------*/
+/* Helper functions */
+
+/*
+ * Return a heap-allocated copy of the specified string, or NULL on failure.
+ */
+static char* copy_string(const char* str) {
+    const size_t size = strlen(str) + 1;
+    char* result      = malloc(size);
+    if (result != NULL)
+        memcpy(result, str, size);
+    return result;
+}
+
+/*
+ * Make sure the specified dynamic array (i.e. a structure with 'arr', 'size'
+ * and 'capacity' members) has room for one more element.
+ */
+#define GROW_ARRAY(LIST)                                                       \
+    ((LIST)->size < (LIST)->capacity ||                                        \
+     grow_array((void**)&(LIST)->arr,                                          \
+                &(LIST)->capacity,                                             \
+                sizeof((LIST)->arr[0])))
+
+static bool grow_array(void** arr, size_t* capacity, size_t item_size) {
+    const size_t new_capacity = (*capacity == 0) ? 64 : *capacity * 2;
+    void* new_arr             = realloc(*arr, new_capacity * item_size);
+    if (new_arr == NULL)
+        return false;
+
+    *arr      = new_arr;
+    *capacity = new_capacity;
+    return true;
+}
+
+static inline bool is_directory(const DiffEntry* entry) {
+    return (entry->entry.attributes & ATTR_DIRECTORY) != 0;
+}
+
+static int compare_entry_paths(const void* a, const void* b) {
+    return strcmp(((const DiffEntry*)a)->path, ((const DiffEntry*)b)->path);
+}
+
+static int compare_change_paths(const void* a, const void* b) {
+    return strcmp(((const DiffChange*)a)->path, ((const DiffChange*)b)->path);
+}
+
+static int compare_rename_lengths(const void* a, const void* b) {
+    const size_t len_a = strlen(((const DirRename*)a)->old_path);
+    const size_t len_b = strlen(((const DirRename*)b)->old_path);
+    return (len_a < len_b) - (len_a > len_b);
+}
+
+static bool push_change(ChangeList* changes,
+                        char kind,
+                        const DiffEntry* entry,
+                        const char* new_path) {
+    if (!GROW_ARRAY(changes))
+        return false;
+
+    DiffChange* change = &changes->arr[changes->size];
+    change->kind       = kind;
+    change->is_dir     = is_directory(entry);
+    change->path       = copy_string(entry->path);
+    change->new_path   = (new_path == NULL) ? NULL : copy_string(new_path);
+    if (change->path == NULL ||
+        (new_path != NULL && change->new_path == NULL)) {
+        free(change->path);
+        free(change->new_path);
+        return false;
+    }
+
+    changes->size++;
+    return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Loading the volumes */
+
+static bool collect_entry(void* ctx,
+                          const char* path,
+                          const DirectoryEntry* entry) {
+    DiffList* list = ctx;
+    if (!GROW_ARRAY(list))
+        return false;
+
+    char* path_copy = copy_string(path);
+    if (path_copy == NULL)
+        return false;
+
+    DiffEntry* dst = &list->arr[list->size++];
+    dst->path      = path_copy;
+    dst->entry     = *entry;
+    dst->has_hash  = false;
+    dst->hash      = 0;
+    dst->matched   = false;
+    return true;
+}
+
+static void free_volume(DiffVolume* volume) {
+    for (size_t i = 0; i < volume->entries.size; i++)
+        free(volume->entries.arr[i].path);
+    free(volume->entries.arr);
+    free(volume->fat.data);
+    free(volume->boot_sector);
+}
+
+static bool load_volume(DiffVolume* volume, const Disk* disk) {
+    volume->disk        = disk;
+    volume->boot_sector = NULL;
+    volume->fat.data    = NULL;
+    volume->fat.size    = 0;
+    volume->entries.arr = NULL;
+    volume->entries.size = volume->entries.capacity = 0;
+
+    volume->boot_sector = read_boot_sector(disk);
+    if (volume->boot_sector == NULL)
+        return false;
+
+    const ExtendedBPB* ebpb = &volume->boot_sector->ebpb;
+    if (!read_fat(&volume->fat, disk, ebpb))
+        return false;
+
+    if (!tree_walk(disk, ebpb, volume->fat, collect_entry, &volume->entries))
+        return false;
+
+    if (volume->entries.size > 0)
+        qsort(volume->entries.arr,
+              volume->entries.size,
+              sizeof(DiffEntry),
+              compare_entry_paths);
+    return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Comparing metadata */
+
+#define DIFF_MEMBER(FP, A, B, FMT, MEMBER_NAME)                                \
+    do {                                                                       \
+        if ((A)->MEMBER_NAME != (B)->MEMBER_NAME)                              \
+            fprintf(FP,                                                        \
+                    "  %s: %" FMT " -> %" FMT "\n",                            \
+                    #MEMBER_NAME,                                              \
+                    (A)->MEMBER_NAME,                                          \
+                    (B)->MEMBER_NAME);                                         \
+    } while (0)
+
+#define DIFF_STR_MEMBER(FP, A, B, MEMBER_NAME)                                 \
+    do {                                                                       \
+        if (memcmp((A)->MEMBER_NAME,                                           \
+                   (B)->MEMBER_NAME,                                           \
+                   sizeof((A)->MEMBER_NAME)) != 0)                             \
+            fprintf(FP,                                                        \
+                    "  %s: %.*s -> %.*s\n",                                    \
+                    #MEMBER_NAME,                                              \
+                    (int)sizeof((A)->MEMBER_NAME),                             \
+                    (const char*)(A)->MEMBER_NAME,                             \
+                    (int)sizeof((B)->MEMBER_NAME),                             \
+                    (const char*)(B)->MEMBER_NAME);                            \
+    } while (0)
+
+/*
+ * Print the differences between the boot sectors of both volumes, if any.
+ */
+static void diff_boot_sectors(FILE* out,
+                              const BootSector* a,
+                              const BootSector* b) {
+    if (memcmp(a, b, sizeof(BootSector)) == 0)
+        return;
+
+    const ExtendedBPB* ebpb_a = &a->ebpb;
+    const ExtendedBPB* ebpb_b = &b->ebpb;
+
+    fprintf(out, "Boot sector:\n");
+    DIFF_STR_MEMBER(out, a, b, oem_identifier);
+    DIFF_MEMBER(out, ebpb_a, ebpb_b, PRIu16, bytes_per_sector);
+    DIFF_MEMBER(out, ebpb_a, ebpb_b, PRIu8, sectors_per_cluster);
+    DIFF_MEMBER(out, ebpb_a, ebpb_b, PRIu16, reserved_sectors);
+    DIFF_MEMBER(out, ebpb_a, ebpb_b, PRIu8, fat_count);
+    DIFF_MEMBER(out, ebpb_a, ebpb_b, PRIu16, dir_entries_count);
+    DIFF_MEMBER(out, ebpb_a, ebpb_b, PRIu16, total_sectors);
+    DIFF_MEMBER(out, ebpb_a, ebpb_b, PRIu8, media_descriptor_type);
+    DIFF_MEMBER(out, ebpb_a, ebpb_b, PRIu16, sectors_per_fat);
+    DIFF_MEMBER(out, ebpb_a, ebpb_b, PRIu16, sectors_per_track);
+    DIFF_MEMBER(out, ebpb_a, ebpb_b, PRIu16, heads);
+    DIFF_MEMBER(out, ebpb_a, ebpb_b, PRIu32, hidden_sectors);
+    DIFF_MEMBER(out, ebpb_a, ebpb_b, PRIu32, large_sector_count);
+    DIFF_MEMBER(out, ebpb_a, ebpb_b, PRIu8, drive_number);
+    DIFF_MEMBER(out, ebpb_a, ebpb_b, PRIu8, signature);
+    DIFF_STR_MEMBER(out, ebpb_a, ebpb_b, volume_label);
+    DIFF_STR_MEMBER(out, ebpb_a, ebpb_b, system_id);
+    if (memcmp(ebpb_a->volume_id,
+               ebpb_b->volume_id,
+               sizeof(ebpb_a->volume_id)) != 0)
+        fprintf(out, "  volume_id: changed\n");
+}
+
+/*
+ * Return true if the clusters of both volumes are located in the same sectors,
+ * so the cluster chains of both FATs can be compared directly.
+ */
+static bool same_layout(const ExtendedBPB* a, const ExtendedBPB* b) {
+    return a->bytes_per_sector == b->bytes_per_sector &&
+           a->sectors_per_cluster == b->sectors_per_cluster &&
+           a->reserved_sectors == b->reserved_sectors &&
+           a->fat_count == b->fat_count &&
+           a->dir_entries_count == b->dir_entries_count &&
+           a->sectors_per_fat == b->sectors_per_fat;
+}
+
+/*
+ * Print the number of FAT entries that changed between both volumes. Assumes
+ * both volumes have the same layout.
+ */
+static void diff_fats(FILE* out, const DiffVolume* a, const DiffVolume* b) {
+    const size_t cluster_count = get_cluster_count(&a->boot_sector->ebpb);
+
+    size_t changed = 0;
+    for (size_t i = 0; i < cluster_count; i++) {
+        const uint16_t cluster = (uint16_t)(i + 2);
+        if (fat12_get_linked_cluster(a->fat, cluster) !=
+            fat12_get_linked_cluster(b->fat, cluster))
+            changed++;
+    }
+
+    if (changed > 0)
+        fprintf(out, "FAT: %zu of %zu entries changed\n", changed,
+                cluster_count);
+}
+
+/*
+ * Return true if the cluster chain that starts at the specified cluster is the
+ * same in both volumes. Only the FATs are accessed, not the data region.
+ */
+static bool chains_equal(const DiffVolume* a,
+                         const DiffVolume* b,
+                         uint16_t cluster) {
+    /* Used to avoid infinite loops in corrupted FATs */
+    size_t remaining = get_cluster_count(&a->boot_sector->ebpb);
+
+    while (fat12_is_data_cluster(cluster)) {
+        const uint16_t next = fat12_get_linked_cluster(a->fat, cluster);
+        if (next != fat12_get_linked_cluster(b->fat, cluster))
+            return false;
+        if (remaining-- == 0)
+            return false;
+        cluster = next;
+    }
+
+    return true;
+}
+
+/*
+ * Calculate the hash of the contents of the specified file, if it was not
+ * calculated already. Only the first 'DirectoryEntry.size' bytes of the cluster
+ * chain are hashed.
+ */
+static bool hash_entry(const DiffVolume* volume, DiffEntry* entry) {
+    if (entry->has_hash)
+        return true;
+
+    const ExtendedBPB* ebpb    = &volume->boot_sector->ebpb;
+    const size_t cluster_bytes = ebpb->bytes_per_sector *
+                                 ebpb->sectors_per_cluster;
+
+    size_t remaining_clusters = get_cluster_count(ebpb);
+    size_t remaining_bytes    = entry->entry.size;
+    uint16_t cluster          = entry->entry.first_cluster_low;
+    uint64_t hash             = FNV1A_INIT;
+
+    while (remaining_bytes > 0 && fat12_is_data_cluster(cluster)) {
+        if (remaining_clusters-- == 0)
+            return false;
+
+        ByteArray data;
+        if (!read_sectors(&data,
+                          volume->disk,
+                          ebpb,
+                          get_cluster_lba(ebpb, cluster),
+                          ebpb->sectors_per_cluster))
+            return false;
+
+        const size_t used = (remaining_bytes < cluster_bytes) ? remaining_bytes
+                                                              : cluster_bytes;
+        hash = hash_fnv1a(hash, data.data, used);
+        free(data.data);
+
+        remaining_bytes -= used;
+        cluster = fat12_get_linked_cluster(volume->fat, cluster);
+    }
+
+    entry->hash     = hash;
+    entry->has_hash = true;
+    return true;
+}
+
+/*
+ * Compare two entries with the same path, and push the appropriate change, if
+ * any.
+ */
+static bool diff_pair(ChangeList* changes,
+                      const DiffVolume* volume_a,
+                      DiffEntry* a,
+                      const DiffVolume* volume_b,
+                      DiffEntry* b,
+                      bool can_compare_chains) {
+    if (is_directory(a) != is_directory(b))
+        return push_change(changes, 'D', a, NULL) &&
+               push_change(changes, 'A', b, NULL);
+
+    const bool same_metadata =
+      a->entry.attributes == b->entry.attributes &&
+      a->entry.modified_date == b->entry.modified_date &&
+      a->entry.modified_time == b->entry.modified_time;
+
+    /* The contents of the directories are compared by their own entries */
+    if (is_directory(a))
+        return same_metadata || push_change(changes, 'T', b, NULL);
+
+    if (same_metadata && a->entry.size == b->entry.size &&
+        a->entry.first_cluster_low == b->entry.first_cluster_low &&
+        can_compare_chains &&
+        chains_equal(volume_a, volume_b, a->entry.first_cluster_low))
+        return true;
+
+    /* Something changed, we need to look at the actual contents */
+    if (!hash_entry(volume_a, a) || !hash_entry(volume_b, b))
+        return false;
+
+    if (a->entry.size != b->entry.size || a->hash != b->hash)
+        return push_change(changes, 'M', b, NULL);
+    if (!same_metadata)
+        return push_change(changes, 'T', b, NULL);
+
+    /* Same contents and metadata, only stored in other clusters */
+    return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Renamed directories */
+
+/*
+ * Replace the 'old_path' prefix of the paths in the specified list with
+ * 'new_path'.
+ */
+static bool apply_rename(DiffList* list, const DirRename* rename) {
+    const size_t old_len = strlen(rename->old_path);
+    const size_t new_len = strlen(rename->new_path);
+
+    for (size_t i = 0; i < list->size; i++) {
+        char* path = list->arr[i].path;
+        if (strncmp(path, rename->old_path, old_len) != 0 ||
+            (path[old_len] != '\0' && path[old_len] != '/'))
+            continue;
+
+        const size_t rest_len = strlen(&path[old_len]);
+        char* new_path        = malloc(new_len + rest_len + 1);
+        if (new_path == NULL)
+            return false;
+        memcpy(new_path, rename->new_path, new_len);
+        memcpy(&new_path[new_len], &path[old_len], rest_len + 1);
+
+        free(path);
+        list->arr[i].path = new_path;
+    }
+
+    return true;
+}
+
+/*
+ * Return true if renaming 'old_path' to 'new_path' is already implied by the
+ * rename of one of its parent directories.
+ */
+static bool is_implied_rename(const DirRename* renames,
+                              size_t renames_size,
+                              const char* old_path,
+                              const char* new_path) {
+    for (size_t i = 0; i < renames_size; i++) {
+        const size_t old_len = strlen(renames[i].old_path);
+        const size_t new_len = strlen(renames[i].new_path);
+        if (strncmp(old_path, renames[i].old_path, old_len) == 0 &&
+            old_path[old_len] == '/' &&
+            strncmp(new_path, renames[i].new_path, new_len) == 0 &&
+            strcmp(&old_path[old_len], &new_path[new_len]) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Detect directories that were renamed or moved in the second volume, because a
+ * directory only present in the first volume starts in the same cluster as a
+ * directory only present in the second one. The paths of the first volume are
+ * then rewritten, so the contents of those directories are compared normally.
+ */
+static bool diff_dir_renames(ChangeList* changes,
+                             DiffVolume* a,
+                             DiffVolume* b) {
+    DiffList* list_a = &a->entries;
+    DiffList* list_b = &b->entries;
+
+    DirRename* renames  = NULL;
+    size_t renames_size = 0, renames_capacity = 0;
+    bool success        = true;
+
+    size_t i = 0, j = 0;
+    while (i < list_a->size) {
+        const int cmp = (j < list_b->size)
+                          ? strcmp(list_a->arr[i].path, list_b->arr[j].path)
+                          : -1;
+        if (cmp == 0) {
+            i++;
+            j++;
+            continue;
+        }
+        if (cmp > 0) {
+            j++;
+            continue;
+        }
+
+        /* Directory that is only present in the first volume */
+        const DiffEntry* old_dir = &list_a->arr[i++];
+        if (!is_directory(old_dir) ||
+            !fat12_is_data_cluster(old_dir->entry.first_cluster_low))
+            continue;
+
+        for (size_t k = 0; k < list_b->size; k++) {
+            DiffEntry* new_dir = &list_b->arr[k];
+            if (new_dir->matched || !is_directory(new_dir) ||
+                new_dir->entry.first_cluster_low !=
+                  old_dir->entry.first_cluster_low)
+                continue;
+
+            /* Make sure the directory is really missing in the first volume */
+            if (bsearch(new_dir,
+                        list_a->arr,
+                        list_a->size,
+                        sizeof(DiffEntry),
+                        compare_entry_paths) != NULL)
+                continue;
+
+            new_dir->matched = true;
+            if (is_implied_rename(renames,
+                                  renames_size,
+                                  old_dir->path,
+                                  new_dir->path))
+                break;
+
+            if (renames_size >= renames_capacity &&
+                !grow_array((void**)&renames,
+                            &renames_capacity,
+                            sizeof(DirRename))) {
+                success = false;
+                goto done;
+            }
+
+            DirRename* rename = &renames[renames_size];
+            rename->old_path  = copy_string(old_dir->path);
+            rename->new_path  = copy_string(new_dir->path);
+            renames_size++;
+            if (rename->old_path == NULL || rename->new_path == NULL ||
+                !push_change(changes, 'R', old_dir, new_dir->path)) {
+                success = false;
+                goto done;
+            }
+
+            break;
+        }
+    }
+
+    /*
+     * Rename the deepest directories first, so the old paths of nested renamed
+     * directories still match.
+     */
+    if (renames_size > 0)
+        qsort(renames,
+              renames_size,
+              sizeof(DirRename),
+              compare_rename_lengths);
+    for (size_t k = 0; k < renames_size && success; k++)
+        success = apply_rename(list_a, &renames[k]);
+
+    if (list_a->size > 0)
+        qsort(list_a->arr,
+              list_a->size,
+              sizeof(DiffEntry),
+              compare_entry_paths);
+    for (size_t k = 0; k < list_b->size; k++)
+        list_b->arr[k].matched = false;
+
+done:
+    for (size_t k = 0; k < renames_size; k++) {
+        free(renames[k].old_path);
+        free(renames[k].new_path);
+    }
+    free(renames);
+    return success;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Moved files */
+
+static int compare_entry_sizes(const void* a, const void* b) {
+    const uint32_t size_a = (*(DiffEntry* const*)a)->entry.size;
+    const uint32_t size_b = (*(DiffEntry* const*)b)->entry.size;
+    return (size_a > size_b) - (size_a < size_b);
+}
+
+/*
+ * Pair deleted and added files with the same contents, and push them as moved
+ * files. The contents are only hashed if the files don't share the same
+ * cluster chain, and only for candidates of the same size.
+ */
+static bool diff_file_moves(ChangeList* changes,
+                            const DiffVolume* volume_a,
+                            DiffEntry** deleted,
+                            size_t deleted_size,
+                            const DiffVolume* volume_b,
+                            DiffEntry** added,
+                            size_t added_size,
+                            bool can_compare_chains) {
+    if (added_size > 0)
+        qsort(added, added_size, sizeof(DiffEntry*), compare_entry_sizes);
+
+    for (size_t i = 0; i < deleted_size; i++) {
+        DiffEntry* old_file = deleted[i];
+        if (is_directory(old_file) || old_file->entry.size == 0)
+            continue;
+
+        /* Find the first added file with the same size */
+        size_t lo = 0, hi = added_size;
+        while (lo < hi) {
+            const size_t mid = lo + (hi - lo) / 2;
+            if (added[mid]->entry.size < old_file->entry.size)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        DiffEntry* found = NULL;
+
+        /* First, look for a file that still uses the same clusters */
+        for (size_t k = lo; can_compare_chains && k < added_size &&
+                            added[k]->entry.size == old_file->entry.size;
+             k++) {
+            DiffEntry* new_file = added[k];
+            if (!new_file->matched && !is_directory(new_file) &&
+                new_file->entry.first_cluster_low ==
+                  old_file->entry.first_cluster_low &&
+                chains_equal(volume_a,
+                             volume_b,
+                             old_file->entry.first_cluster_low)) {
+                found = new_file;
+                break;
+            }
+        }
+
+        /* Otherwise, compare the contents */
+        for (size_t k = lo; found == NULL && k < added_size &&
+                            added[k]->entry.size == old_file->entry.size;
+             k++) {
+            DiffEntry* new_file = added[k];
+            if (new_file->matched || is_directory(new_file))
+                continue;
+
+            if (!hash_entry(volume_a, old_file) ||
+                !hash_entry(volume_b, new_file))
+                return false;
+
+            if (old_file->hash == new_file->hash)
+                found = new_file;
+        }
+
+        if (found == NULL)
+            continue;
+
+        if (!push_change(changes, 'R', old_file, found->path))
+            return false;
+        old_file->matched = true;
+        found->matched    = true;
+    }
+
+    for (size_t i = 0; i < deleted_size; i++)
+        if (!deleted[i]->matched &&
+            !push_change(changes, 'D', deleted[i], NULL))
+            return false;
+
+    for (size_t i = 0; i < added_size; i++)
+        if (!added[i]->matched && !push_change(changes, 'A', added[i], NULL))
+            return false;
+
+    return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Main function */
+
+static bool diff_trees(ChangeList* changes, DiffVolume* a, DiffVolume* b) {
+    const bool can_compare_chains =
+      same_layout(&a->boot_sector->ebpb, &b->boot_sector->ebpb);
+
+    if (can_compare_chains && !diff_dir_renames(changes, a, b))
+        return false;
+
+    /* Files that are only present in one of the volumes */
+    DiffEntry** deleted = malloc(a->entries.size * sizeof(DiffEntry*) + 1);
+    DiffEntry** added   = malloc(b->entries.size * sizeof(DiffEntry*) + 1);
+    size_t deleted_size = 0, added_size = 0;
+    bool success        = (deleted != NULL && added != NULL);
+
+    size_t i = 0, j = 0;
+    while (success && (i < a->entries.size || j < b->entries.size)) {
+        int cmp;
+        if (i >= a->entries.size)
+            cmp = 1;
+        else if (j >= b->entries.size)
+            cmp = -1;
+        else
+            cmp = strcmp(a->entries.arr[i].path, b->entries.arr[j].path);
+
+        if (cmp < 0) {
+            deleted[deleted_size++] = &a->entries.arr[i++];
+        } else if (cmp > 0) {
+            added[added_size++] = &b->entries.arr[j++];
+        } else {
+            success = diff_pair(changes,
+                                a,
+                                &a->entries.arr[i++],
+                                b,
+                                &b->entries.arr[j++],
+                                can_compare_chains);
+        }
+    }
+
+    if (success)
+        success = diff_file_moves(changes,
+                                  a,
+                                  deleted,
+                                  deleted_size,
+                                  b,
+                                  added,
+                                  added_size,
+                                  can_compare_chains);
+
+    free(deleted);
+    free(added);
+    return success;
+}
+
+bool diff_images(FILE* out, const Disk* disk_a, const Disk* disk_b) {
+    DiffVolume a, b;
+    ChangeList changes = { NULL, 0, 0 };
+    bool success       = load_volume(&a, disk_a);
+    success            = load_volume(&b, disk_b) && success;
+    if (!success)
+        goto done;
+
+    diff_boot_sectors(out, a.boot_sector, b.boot_sector);
+    if (same_layout(&a.boot_sector->ebpb, &b.boot_sector->ebpb))
+        diff_fats(out, &a, &b);
+
+    success = diff_trees(&changes, &a, &b);
+    if (!success)
+        goto done;
+
+    /* The array is NULL when there are no changes */
+    if (changes.size > 0)
+        qsort(changes.arr,
+              changes.size,
+              sizeof(DiffChange),
+              compare_change_paths);
+    for (size_t i = 0; i < changes.size; i++) {
+        const DiffChange* change = &changes.arr[i];
+        const char* suffix       = change->is_dir ? "/" : "";
+        if (change->kind == 'R')
+            fprintf(out,
+                    "R %s%s -> %s%s\n",
+                    change->path,
+                    suffix,
+                    change->new_path,
+                    suffix);
+        else
+            fprintf(out, "%c %s%s\n", change->kind, change->path, suffix);
+    }
+
+done:
+    for (size_t i = 0; i < changes.size; i++) {
+        free(changes.arr[i].path);
+        free(changes.arr[i].new_path);
+    }
+    free(changes.arr);
+    free_volume(&a);
+    free_volume(&b);
+    return success;
+}
@@ -0,0 +1,256 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Needed for 'O_DIRECT', 'MAP_HUGETLB' and 'MADV_HUGEPAGE' */
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "include/disk.h"
+#include "include/direct.h"
+
+/*
+ * Size of the whole buffer pool. It's a multiple of the usual huge page size
+ * (2 MiB), as required by 'MAP_HUGETLB'.
+ */
+#define POOL_SIZE (DIRECT_BLOCK_SIZE * DIRECT_POOL_BLOCKS)
+
+/*
+ * Block of the image stored in a buffer of the pool.
+ */
+typedef struct {
+    uint8_t* data;
+    uint64_t block;    /* Index of the block, i.e. offset / DIRECT_BLOCK_SIZE */
+    size_t valid;      /* Bytes read, smaller than the block at end of file */
+    uint64_t last_use; /* For choosing the least recently used buffer */
+    bool loaded;
+} DirectBuffer;
+
+/*
+ * Context of the 'O_DIRECT' backend. The pool is shared by all the threads
+ * reading the disk, so it's protected by a mutex.
+ */
+typedef struct {
+    int fd;
+    uint8_t* pool;
+    DirectBuffer buffers[DIRECT_POOL_BLOCKS];
+    uint64_t clock;
+    pthread_mutex_t lock;
+} DirectDisk;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Allocate the memory of the buffer pool, preferring huge pages. The pages are
+ * populated immediately, so the memory usage doesn't change while reading.
+ */
+static uint8_t* alloc_pool(void) {
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    void* pool = mmap(NULL,
+                      POOL_SIZE,
+                      PROT_READ | PROT_WRITE,
+                      flags | MAP_HUGETLB | MAP_POPULATE,
+                      -1,
+                      0);
+    if (pool != MAP_FAILED)
+        return pool;
+
+    /*
+     * No huge pages were reserved. Use normal pages, which are always aligned
+     * enough for 'O_DIRECT', and ask for transparent huge pages instead. The
+     * request must be made before the pages are faulted in, so they are
+     * populated by hand afterwards instead of with 'MAP_POPULATE'.
+     */
+    pool = mmap(NULL, POOL_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (pool == MAP_FAILED)
+        return NULL;
+
+#ifdef MADV_HUGEPAGE
+    madvise(pool, POOL_SIZE, MADV_HUGEPAGE);
+#endif
+    memset(pool, 0, POOL_SIZE);
+    return pool;
+}
+
+/*
+ * Read up to 'size' bytes at the specified offset. All the arguments must be
+ * aligned to 'DIRECT_ALIGNMENT'. Returns the number of bytes read, which is
+ * only smaller than 'size' at the end of the file, or -1 on error.
+ */
+static ssize_t pread_aligned(int fd,
+                             uint8_t* dst,
+                             size_t size,
+                             uint64_t offset) {
+    size_t total = 0;
+    while (total < size) {
+        const ssize_t bytes_read =
+          pread(fd, &dst[total], size - total, (off_t)(offset + total));
+        if (bytes_read < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        total += (size_t)bytes_read;
+
+        /* After a short read, the next offset would not be aligned */
+        if (bytes_read == 0 || total % DIRECT_ALIGNMENT != 0)
+            break;
+    }
+
+    return (ssize_t)total;
+}
+
+/*
+ * Return the buffer containing the specified block, reading it into the least
+ * recently used buffer if necessary. Must be called with the lock held.
+ */
+static DirectBuffer* get_block(DirectDisk* direct, uint64_t block) {
+    DirectBuffer* victim = &direct->buffers[0];
+    for (size_t i = 0; i < DIRECT_POOL_BLOCKS; i++) {
+        DirectBuffer* buffer = &direct->buffers[i];
+        if (buffer->loaded && buffer->block == block) {
+            buffer->last_use = ++direct->clock;
+            return buffer;
+        }
+
+        if (!buffer->loaded ||
+            (victim->loaded && buffer->last_use < victim->last_use))
+            victim = buffer;
+    }
+
+    const ssize_t bytes_read = pread_aligned(direct->fd,
+                                             victim->data,
+                                             DIRECT_BLOCK_SIZE,
+                                             block * DIRECT_BLOCK_SIZE);
+    if (bytes_read < 0) {
+        victim->loaded = false;
+        return NULL;
+    }
+
+    victim->block    = block;
+    victim->valid    = (size_t)bytes_read;
+    victim->last_use = ++direct->clock;
+    victim->loaded   = true;
+    return victim;
+}
+
+static inline bool is_aligned(uint64_t value) {
+    return value % DIRECT_ALIGNMENT == 0;
+}
+
+static bool direct_read(void* ctx, void* dst, size_t size, uint64_t offset) {
+    DirectDisk* direct = ctx;
+    uint8_t* ptr       = dst;
+
+    /* Big aligned reads don't need to go through the pool */
+    if (size >= DIRECT_BLOCK_SIZE && is_aligned((uintptr_t)dst) &&
+        is_aligned(size) && is_aligned(offset))
+        return pread_aligned(direct->fd, ptr, size, offset) == (ssize_t)size;
+
+    bool success = true;
+    pthread_mutex_lock(&direct->lock);
+
+    while (size > 0) {
+        const uint64_t block        = offset / DIRECT_BLOCK_SIZE;
+        const size_t block_offset   = offset % DIRECT_BLOCK_SIZE;
+        const DirectBuffer* buffer = get_block(direct, block);
+        if (buffer == NULL || block_offset >= buffer->valid) {
+            success = false;
+            break;
+        }
+
+        size_t chunk = buffer->valid - block_offset;
+        if (chunk > size)
+            chunk = size;
+        memcpy(ptr, &buffer->data[block_offset], chunk);
+
+        ptr += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+
+    pthread_mutex_unlock(&direct->lock);
+    return success;
+}
+
+static void direct_close(void* ctx) {
+    DirectDisk* direct = ctx;
+    munmap(direct->pool, POOL_SIZE);
+    close(direct->fd);
+    pthread_mutex_destroy(&direct->lock);
+    free(direct);
+}
+
+static const DiskBackend direct_backend = {
+    .read  = direct_read,
+    .close = direct_close,
+};
+
+/*----------------------------------------------------------------------------*/
+
+bool direct_disk_open(Disk* disk, const char* path) {
+    DirectDisk* direct = calloc(1, sizeof(DirectDisk));
+    if (direct == NULL)
+        return false;
+
+    direct->fd = open(path, O_RDONLY | O_DIRECT);
+    if (direct->fd < 0) {
+        free(direct);
+        return false;
+    }
+
+    direct->pool = alloc_pool();
+    if (direct->pool == NULL) {
+        close(direct->fd);
+        free(direct);
+        return false;
+    }
+
+    for (size_t i = 0; i < DIRECT_POOL_BLOCKS; i++)
+        direct->buffers[i].data = &direct->pool[i * DIRECT_BLOCK_SIZE];
+
+    /*
+     * Read the first block, so file systems that don't support direct reads
+     * are detected now (with EINVAL) rather than in the first real read.
+     */
+    if (get_block(direct, 0) == NULL ||
+        pthread_mutex_init(&direct->lock, NULL) != 0) {
+        const int saved_errno = errno;
+        munmap(direct->pool, POOL_SIZE);
+        close(direct->fd);
+        free(direct);
+        errno = saved_errno;
+        return false;
+    }
+
+    disk->backend     = &direct_backend;
+    disk->backend_ctx = direct;
+    return true;
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "include/fat12.h"
+#include "include/dirscan.h"
+
+/*
+ * Number of entries classified by each call to 'classify_group'. Since entries
+ * are 32 bytes long, this is 512 bytes, usually a whole sector.
+ */
+#define GROUP_SIZE 16
+
+/*
+ * Bit masks with the properties of a group of entries. Bit N corresponds to
+ * the N-th entry of the group.
+ */
+typedef struct {
+    uint32_t end;       /* First byte of the name is ENTRY_FREE */
+    uint32_t deleted;   /* First byte of the name is ENTRY_DELETED */
+    uint32_t long_name; /* All the ATTR_LONG_NAME bits are set */
+    uint32_t volume_id; /* ATTR_VOLUME_ID is set */
+    uint32_t directory; /* ATTR_DIRECTORY is set */
+} GroupMasks;
+
+/*
+ * Fill the masks of the first 'count' entries of 'arr', one entry at a time.
+ * Used for the last entries of a directory, and when SSE2 is not available.
+ */
+static void classify_group_scalar(const DirectoryEntry* arr,
+                                  size_t count,
+                                  GroupMasks* masks) {
+    *masks = (GroupMasks){ 0 };
+
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t first_byte = arr[i].name[0];
+        const uint8_t attributes = arr[i].attributes;
+        const uint32_t bit       = 1u << i;
+
+        if (first_byte == ENTRY_FREE)
+            masks->end |= bit;
+        if (first_byte == ENTRY_DELETED)
+            masks->deleted |= bit;
+        if ((attributes & ATTR_LONG_NAME) == ATTR_LONG_NAME)
+            masks->long_name |= bit;
+        if (attributes & ATTR_VOLUME_ID)
+            masks->volume_id |= bit;
+        if (attributes & ATTR_DIRECTORY)
+            masks->directory |= bit;
+    }
+}
+
+#ifdef __SSE2__
+/*
+ * Load the first 16 bytes of 4 consecutive entries, and return a vector with
+ * the first byte of each name in the low byte of each 32-bit lane, and another
+ * one with the attributes (offset 11) in the high byte of each lane.
+ */
+static inline void gather_entries(const DirectoryEntry* arr,
+                                  __m128i* names,
+                                  __m128i* attributes) {
+    const __m128i a = _mm_loadu_si128((const __m128i*)&arr[0]);
+    const __m128i b = _mm_loadu_si128((const __m128i*)&arr[1]);
+    const __m128i c = _mm_loadu_si128((const __m128i*)&arr[2]);
+    const __m128i d = _mm_loadu_si128((const __m128i*)&arr[3]);
+
+    /* Dwords 0 and 2 of each entry: a0 b0 c0 d0 and a2 b2 c2 d2 */
+    const __m128i dword0 = _mm_unpacklo_epi64(_mm_unpacklo_epi32(a, b),
+                                              _mm_unpacklo_epi32(c, d));
+    const __m128i dword2 = _mm_unpacklo_epi64(_mm_unpackhi_epi32(a, b),
+                                              _mm_unpackhi_epi32(c, d));
+
+    *names      = _mm_and_si128(dword0, _mm_set1_epi32(0xFF));
+    *attributes = _mm_srli_epi32(dword2, 24);
+}
+
+/*
+ * Return a vector with the specified byte of 16 consecutive entries, given the
+ * 32-bit lanes returned by 'gather_entries'.
+ */
+static inline __m128i pack_lanes(__m128i l0,
+                                 __m128i l1,
+                                 __m128i l2,
+                                 __m128i l3) {
+    /* All the lanes are in the [0..255] range, so there is no saturation */
+    return _mm_packus_epi16(_mm_packs_epi32(l0, l1), _mm_packs_epi32(l2, l3));
+}
+
+static inline uint32_t mask_equal(__m128i bytes, uint8_t value) {
+    return (uint32_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)value)));
+}
+
+static inline uint32_t mask_all_set(__m128i bytes, uint8_t bits) {
+    const __m128i bits_vec = _mm_set1_epi8((char)bits);
+    return (uint32_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_and_si128(bytes, bits_vec), bits_vec));
+}
+
+/*
+ * Fill the masks of the 'GROUP_SIZE' entries of 'arr' with vector operations.
+ */
+static void classify_group(const DirectoryEntry* arr, GroupMasks* masks) {
+    __m128i n0, n1, n2, n3, a0, a1, a2, a3;
+    gather_entries(&arr[0], &n0, &a0);
+    gather_entries(&arr[4], &n1, &a1);
+    gather_entries(&arr[8], &n2, &a2);
+    gather_entries(&arr[12], &n3, &a3);
+
+    const __m128i names      = pack_lanes(n0, n1, n2, n3);
+    const __m128i attributes = pack_lanes(a0, a1, a2, a3);
+
+    masks->end       = mask_equal(names, ENTRY_FREE);
+    masks->deleted   = mask_equal(names, ENTRY_DELETED);
+    masks->long_name = mask_all_set(attributes, ATTR_LONG_NAME);
+    masks->volume_id = mask_all_set(attributes, ATTR_VOLUME_ID);
+    masks->directory = mask_all_set(attributes, ATTR_DIRECTORY);
+}
+#else
+static void classify_group(const DirectoryEntry* arr, GroupMasks* masks) {
+    classify_group_scalar(arr, GROUP_SIZE, masks);
+}
+#endif /* __SSE2__ */
+
+/*
+ * Write to 'dst' the indices of the first 'count' entries of a group whose
+ * class is in the 'classes' mask, up to the end marker. The 'base' argument is
+ * the index of the first entry of the group. Returns the number of indices
+ * written, and sets 'end_pos' to the position of the end marker inside the
+ * group, or to 'count'.
+ */
+static size_t select_entries(const GroupMasks* masks,
+                             size_t count,
+                             size_t base,
+                             unsigned classes,
+                             uint32_t* dst,
+                             size_t* end_pos) {
+    uint32_t valid = (1u << count) - 1;
+
+    *end_pos = count;
+    if (masks->end & valid) {
+        *end_pos = (size_t)__builtin_ctz(masks->end & valid);
+        valid &= (1u << *end_pos) - 1;
+    }
+
+    /* Each entry belongs to the first class that matches, in this order */
+    const uint32_t deleted   = masks->deleted & valid;
+    const uint32_t long_name = masks->long_name & valid & ~deleted;
+    const uint32_t volume    = masks->volume_id & valid & ~deleted & ~long_name;
+    const uint32_t other     = valid & ~deleted & ~long_name & ~volume;
+    const uint32_t directory = masks->directory & other;
+    const uint32_t file      = other & ~directory;
+
+    uint32_t selected = 0;
+    if (classes & DIRENT_DELETED)
+        selected |= deleted;
+    if (classes & DIRENT_LONG_NAME)
+        selected |= long_name;
+    if (classes & DIRENT_VOLUME_LABEL)
+        selected |= volume;
+    if (classes & DIRENT_DIRECTORY)
+        selected |= directory;
+    if (classes & DIRENT_FILE)
+        selected |= file;
+
+    size_t written = 0;
+    while (selected != 0) {
+        dst[written++] = (uint32_t)(base + (size_t)__builtin_ctz(selected));
+        selected &= selected - 1;
+    }
+
+    return written;
+}
+
+size_t dirscan_classify(const DirectoryEntry* arr,
+                        size_t size,
+                        unsigned classes,
+                        uint32_t* dst,
+                        size_t* end) {
+    size_t written = 0;
+
+    for (size_t base = 0; base < size; base += GROUP_SIZE) {
+        const size_t count = (size - base < GROUP_SIZE) ? size - base
+                                                        : GROUP_SIZE;
+
+        GroupMasks masks;
+        if (count == GROUP_SIZE)
+            classify_group(&arr[base], &masks);
+        else
+            classify_group_scalar(&arr[base], count, &masks);
+
+        size_t end_pos;
+        written += select_entries(&masks,
+                                  count,
+                                  base,
+                                  classes,
+                                  (dst == NULL) ? NULL : &dst[written],
+                                  &end_pos);
+
+        if (end_pos < count) {
+            if (end != NULL)
+                *end = base + end_pos;
+            return written;
+        }
+    }
+
+    if (end != NULL)
+        *end = size;
+    return written;
+}
+
+void dirscan_init(DirScan* scan,
+                  const DirectoryEntry* arr,
+                  size_t size,
+                  unsigned classes) {
+    scan->arr         = arr;
+    scan->size        = size;
+    scan->pos         = 0;
+    scan->classes     = classes;
+    scan->batch_count = 0;
+    scan->batch_pos   = 0;
+}
+
+const DirectoryEntry* dirscan_next(DirScan* scan) {
+    while (scan->batch_pos >= scan->batch_count) {
+        if (scan->pos >= scan->size)
+            return NULL;
+
+        const size_t start     = scan->pos;
+        const size_t remaining = scan->size - start;
+        const size_t count =
+          (remaining < DIRSCAN_BATCH) ? remaining : DIRSCAN_BATCH;
+
+        size_t end;
+        scan->batch_count = dirscan_classify(&scan->arr[start],
+                                             count,
+                                             scan->classes,
+                                             scan->batch,
+                                             &end);
+        scan->batch_pos = 0;
+
+        /* The indices are relative to the start of this batch */
+        for (size_t i = 0; i < scan->batch_count; i++)
+            scan->batch[i] += (uint32_t)start;
+
+        /* Nothing after the end marker will be classified */
+        scan->pos = start + end;
+        if (end < count)
+            scan->size = scan->pos;
+    }
+
+    return &scan->arr[scan->batch[scan->batch_pos++]];
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Needed for 'pread' */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "include/disk.h"
+#include "include/gzip.h"
+#include "include/direct.h"
+
+bool disk_open(Disk* disk, const char* path, unsigned flags) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    disk->fd          = fd;
+    disk->offset      = 0;
+    disk->size        = (uint64_t)st.st_size;
+    disk->backend     = NULL;
+    disk->backend_ctx = NULL;
+
+    /* Block devices report a size of zero, ask for their real size */
+    if (S_ISBLK(st.st_mode)) {
+        const off_t end = lseek(fd, 0, SEEK_END);
+        if (end > 0)
+            disk->size = (uint64_t)end;
+    }
+
+    if (is_gzip_file(fd)) {
+        if (!gzip_disk_open(disk, path)) {
+            close(fd);
+            return false;
+        }
+    } else if ((flags & DISK_DIRECT_IO) && !direct_disk_open(disk, path)) {
+        close(fd);
+        return false;
+    }
+
+    return true;
+}
+
+void disk_close(Disk* disk) {
+    if (disk->backend != NULL)
+        disk->backend->close(disk->backend_ctx);
+    close(disk->fd);
+    disk->fd = -1;
+}
+
+bool disk_read(const Disk* disk, void* dst, size_t size, uint64_t offset) {
+    if (offset > disk->size || size > disk->size - offset)
+        return false;
+
+    if (disk->backend != NULL)
+        return disk->backend->read(disk->backend_ctx,
+                                   dst,
+                                   size,
+                                   disk->offset + offset);
+
+    char* ptr    = dst;
+    uint64_t pos = disk->offset + offset;
+    while (size > 0) {
+        const ssize_t bytes_read = pread(disk->fd, ptr, size, (off_t)pos);
+        if (bytes_read < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        /* Unexpected end of file */
+        if (bytes_read == 0)
+            return false;
+
+        ptr += bytes_read;
+        pos += (uint64_t)bytes_read;
+        size -= (size_t)bytes_read;
+    }
+
+    return true;
+}
+
+Disk disk_region(const Disk* disk, uint64_t offset, uint64_t size) {
+    Disk result = *disk;
+
+    if (offset > disk->size)
+        offset = disk->size;
+    if (size > disk->size - offset)
+        size = disk->size - offset;
+
+    result.offset = disk->offset + offset;
+    result.size   = size;
+    return result;
+}
@@ -0,0 +1,450 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Needed for 'copy_file_range' and 'splice' */
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h> /* snprintf */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/sendfile.h>
+
+#include "include/bytearray.h"
+#include "include/disk.h"
+#include "include/fat12.h"
+#include "include/tree.h"
+#include "include/util.h"
+#include "include/export.h"
+
+/*
+ * Size of the tar blocks. Headers occupy a whole block, and file contents are
+ * padded to a multiple of this size.
+ */
+#define TAR_BLOCK_SIZE 512
+
+/*
+ * Size of the buffer used for copying data when the kernel can't do it.
+ */
+#define BUFFERED_COPY_SIZE (64 * 1024)
+
+/*
+ * Header of a file in an ustar archive. The numeric fields are stored as
+ * NULL-terminated octal strings.
+ *
+ * See the "ustar Interchange Format" section of:
+ * https://pubs.opengroup.org/onlinepubs/9699919799/utilities/pax.html
+ */
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+} TarHeader;
+STATIC_ASSERT(sizeof(TarHeader) == TAR_BLOCK_SIZE);
+
+/*
+ * Methods for copying data from the disk image to the output, from fastest to
+ * slowest. When a method is not supported for the current pair of files, the
+ * next one is tried.
+ */
+enum ECopyMethod {
+    COPY_FILE_RANGE,
+    COPY_SPLICE,
+    COPY_SENDFILE,
+    COPY_BUFFERED,
+};
+
+/*
+ * State of 'export_tar', shared by the tree visitor.
+ */
+typedef struct {
+    int out_fd;
+    const char* prefix;
+    const Disk* disk;
+    const ExtendedBPB* ebpb;
+    ByteArray fat;
+    enum ECopyMethod method;
+    char* buffer; /* Used by 'copy_buffered', allocated on the first call */
+} TarExport;
+
+/*----------------------------------------------------------------------------*/
+/* Low-level output */
+
+/*
+ * Write the whole buffer to the specified file descriptor, retrying on partial
+ * writes.
+ */
+static bool write_all(int fd, const void* data, size_t size) {
+    const char* ptr = data;
+    while (size > 0) {
+        const ssize_t written = write(fd, ptr, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        ptr += written;
+        size -= (size_t)written;
+    }
+
+    return true;
+}
+
+/*
+ * Write 'size' zero bytes to the specified file descriptor.
+ */
+static bool write_zeros(int fd, size_t size) {
+    static const char zeros[TAR_BLOCK_SIZE] = { 0 };
+
+    while (size > 0) {
+        const size_t chunk = (size < sizeof(zeros)) ? size : sizeof(zeros);
+        if (!write_all(fd, zeros, chunk))
+            return false;
+        size -= chunk;
+    }
+
+    return true;
+}
+
+/*
+ * Copy 'size' bytes from 'offset' in the disk into the output, using the
+ * user-space buffer of the export. Returns the number of bytes copied, or -1 on
+ * error.
+ */
+static ssize_t copy_buffered(TarExport* exp, uint64_t offset, size_t size) {
+    if (exp->buffer == NULL) {
+        exp->buffer = malloc(BUFFERED_COPY_SIZE);
+        if (exp->buffer == NULL)
+            return -1;
+    }
+
+    if (size > BUFFERED_COPY_SIZE)
+        size = BUFFERED_COPY_SIZE;
+
+    if (!disk_read(exp->disk, exp->buffer, size, offset)) {
+        errno = EIO;
+        return -1;
+    }
+
+    return write_all(exp->out_fd, exp->buffer, size) ? (ssize_t)size : -1;
+}
+
+/*
+ * Return true if the specified error means that the copy method is not
+ * supported for the current files, rather than an actual I/O error.
+ */
+static inline bool is_unsupported_error(int error) {
+    return error == EINVAL || error == ENOSYS || error == EXDEV ||
+           error == EBADF || error == EOPNOTSUPP || error == ESPIPE;
+}
+
+/*
+ * Copy 'size' bytes at the specified byte offset of the volume into the
+ * output, without modifying the position of the disk file.
+ */
+static bool copy_range(TarExport* exp, uint64_t offset, uint64_t size) {
+    const int disk_fd = exp->disk->fd;
+
+    while (size > 0) {
+        off_t in_offset = (off_t)(exp->disk->offset + offset);
+        ssize_t copied;
+
+        switch (exp->method) {
+            case COPY_FILE_RANGE:
+                /* Only works if the output is a regular file */
+                copied = copy_file_range(disk_fd,
+                                         &in_offset,
+                                         exp->out_fd,
+                                         NULL,
+                                         size,
+                                         0);
+                break;
+
+            case COPY_SPLICE:
+                /* Only works if the output is a pipe */
+                copied = splice(disk_fd,
+                                &in_offset,
+                                exp->out_fd,
+                                NULL,
+                                size,
+                                SPLICE_F_MOVE | SPLICE_F_MORE);
+                break;
+
+            case COPY_SENDFILE:
+                copied = sendfile(exp->out_fd, disk_fd, &in_offset, size);
+                break;
+
+            default:
+            case COPY_BUFFERED:
+                copied = copy_buffered(exp, offset, size);
+                break;
+        }
+
+        if (copied < 0) {
+            if (errno == EINTR)
+                continue;
+
+            /*
+             * Try the next method. Note that these errors are only reported
+             * before any data is written, so the output is still consistent.
+             */
+            if (exp->method != COPY_BUFFERED && is_unsupported_error(errno)) {
+                exp->method++;
+                continue;
+            }
+
+            return false;
+        }
+
+        /* Unexpected end of the disk image */
+        if (copied == 0)
+            return false;
+
+        offset += (uint64_t)copied;
+        size -= (uint64_t)copied;
+    }
+
+    return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Tar headers */
+
+/*
+ * Write the specified value as a NULL-terminated octal number that fills the
+ * whole field.
+ */
+static void set_octal(char* field, size_t field_size, uint64_t value) {
+    snprintf(field, field_size, "%0*" PRIo64, (int)field_size - 1, value);
+}
+
+/*
+ * Store the path of the entry in the 'name' and 'prefix' fields of the tar
+ * header. The path is split at a slash if it doesn't fit in the 'name' field.
+ */
+static bool set_header_path(TarHeader* header, const char* path) {
+    const size_t len = strlen(path);
+    if (len <= sizeof(header->name)) {
+        memcpy(header->name, path, len);
+        return true;
+    }
+
+    /*
+     * Find the first slash that leaves a name short enough, so the prefix is
+     * as short as possible. The trailing slash of a directory can't be used,
+     * since it would leave an empty name.
+     */
+    for (size_t i = len - sizeof(header->name) - 1; i + 1 < len; i++) {
+        if (path[i] != '/')
+            continue;
+        if (i > sizeof(header->prefix))
+            return false;
+
+        memcpy(header->prefix, path, i);
+        memcpy(header->name, &path[i + 1], len - i - 1);
+        return true;
+    }
+
+    return false;
+}
+
+static bool write_header(TarExport* exp,
+                         const char* path,
+                         const DirectoryEntry* entry) {
+    const bool is_dir = (entry->attributes & ATTR_DIRECTORY) != 0;
+
+    TarHeader header;
+    memset(&header, 0, sizeof(header));
+
+    /* Paths in tar archives are relative, directories end with a slash */
+    char tar_path[TREE_PATH_MAX + 1];
+    const int len = snprintf(tar_path, sizeof(tar_path), "%s%s%s", exp->prefix,
+                             &path[1], is_dir ? "/" : "");
+    if (len < 0 || (size_t)len >= sizeof(tar_path) ||
+        !set_header_path(&header, tar_path)) {
+        ERR("Path '%s' is too long for a tar archive.", path);
+        return false;
+    }
+
+    unsigned mode = is_dir ? 0755 : 0644;
+    if (entry->attributes & ATTR_READ_ONLY)
+        mode &= ~0222u;
+
+    set_octal(header.mode, sizeof(header.mode), mode);
+    set_octal(header.uid, sizeof(header.uid), 0);
+    set_octal(header.gid, sizeof(header.gid), 0);
+    set_octal(header.size, sizeof(header.size), is_dir ? 0 : entry->size);
+    set_octal(header.mtime,
+              sizeof(header.mtime),
+              (uint64_t)fat_timestamp_to_unix(entry->modified_date,
+                                              entry->modified_time));
+    header.typeflag = is_dir ? '5' : '0';
+    memcpy(header.magic, "ustar", sizeof(header.magic));
+    memcpy(header.version, "00", sizeof(header.version));
+
+    /*
+     * The checksum is the sum of all the bytes in the header, with the checksum
+     * field itself filled with spaces. It's stored as six octal digits, a NULL
+     * byte and a space.
+     */
+    memset(header.checksum, ' ', sizeof(header.checksum));
+    uint32_t checksum = 0;
+    for (size_t i = 0; i < sizeof(header); i++)
+        checksum += ((const uint8_t*)&header)[i];
+    snprintf(header.checksum, sizeof(header.checksum), "%06" PRIo32, checksum);
+    header.checksum[7] = ' ';
+
+    return write_all(exp->out_fd, &header, sizeof(header));
+}
+
+/*----------------------------------------------------------------------------*/
+/* File contents */
+
+/*
+ * Write the contents of the specified file, followed by the padding of the
+ * last tar block. Consecutive clusters in the chain are copied as a single
+ * extent.
+ */
+static bool write_contents(TarExport* exp,
+                           const char* path,
+                           const DirectoryEntry* entry) {
+    const ExtendedBPB* ebpb      = exp->ebpb;
+    const uint64_t cluster_bytes = (uint64_t)ebpb->bytes_per_sector *
+                                   ebpb->sectors_per_cluster;
+
+    size_t remaining_clusters = get_cluster_count(ebpb);
+    uint64_t remaining_bytes  = entry->size;
+    uint16_t cluster          = entry->first_cluster_low;
+
+    while (remaining_bytes > 0 && fat12_is_data_cluster(cluster) &&
+           remaining_clusters > 0) {
+        /* Find the end of the current extent */
+        const uint16_t extent_start = cluster;
+        uint64_t extent_bytes       = cluster_bytes;
+        uint16_t next = fat12_get_linked_cluster(exp->fat, cluster);
+        remaining_clusters--;
+        while (next == cluster + 1 && extent_bytes < remaining_bytes &&
+               remaining_clusters > 0) {
+            cluster = next;
+            next    = fat12_get_linked_cluster(exp->fat, cluster);
+            extent_bytes += cluster_bytes;
+            remaining_clusters--;
+        }
+
+        if (extent_bytes > remaining_bytes)
+            extent_bytes = remaining_bytes;
+
+        const uint64_t offset = (uint64_t)get_cluster_lba(ebpb, extent_start) *
+                                ebpb->bytes_per_sector;
+        if (!copy_range(exp, offset, extent_bytes))
+            return false;
+
+        remaining_bytes -= extent_bytes;
+        cluster = next;
+    }
+
+    /*
+     * The size of the tar entry was already written in the header, so if the
+     * cluster chain is shorter than the file, the rest is filled with zeros.
+     */
+    if (remaining_bytes > 0) {
+        ERR("Warning: Cluster chain of '%s' is shorter than its size.", path);
+        if (!write_zeros(exp->out_fd, remaining_bytes))
+            return false;
+    }
+
+    const size_t padding = (TAR_BLOCK_SIZE - entry->size % TAR_BLOCK_SIZE) %
+                           TAR_BLOCK_SIZE;
+    return write_zeros(exp->out_fd, padding);
+}
+
+static bool export_visit(void* ctx,
+                         const char* path,
+                         const DirectoryEntry* entry) {
+    TarExport* exp = ctx;
+
+    if (!write_header(exp, path, entry))
+        return false;
+
+    if (entry->attributes & ATTR_DIRECTORY)
+        return true;
+
+    return write_contents(exp, path, entry);
+}
+
+bool export_tar_entries(int out_fd, const Disk* disk, const char* prefix) {
+    BootSector* boot_sector = read_boot_sector(disk);
+    if (boot_sector == NULL)
+        return false;
+
+    ByteArray fat;
+    if (!read_fat(&fat, disk, &boot_sector->ebpb)) {
+        free(boot_sector);
+        return false;
+    }
+
+    TarExport exp = {
+        .out_fd = out_fd,
+        .prefix = prefix,
+        .disk   = disk,
+        .ebpb   = &boot_sector->ebpb,
+        .fat    = fat,
+
+        /* The kernel can only copy data from uncompressed images */
+        .method = (disk->backend == NULL) ? COPY_FILE_RANGE : COPY_BUFFERED,
+    };
+
+    const bool success =
+      tree_walk(disk, &boot_sector->ebpb, fat, export_visit, &exp);
+
+    free(exp.buffer);
+    free(fat.data);
+    free(boot_sector);
+    return success;
+}
+
+bool export_tar_end(int out_fd) {
+    /* The archive ends with two empty blocks */
+    return write_zeros(out_fd, 2 * TAR_BLOCK_SIZE);
+}
+
+bool export_tar(int out_fd, const Disk* disk) {
+    return export_tar_entries(out_fd, disk, "") && export_tar_end(out_fd);
+}
@@ -25,12 +25,13 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
-#include <stdio.h> /* FILE */
 #include <stdlib.h>
 #include <string.h>
 
 #include "include/bytearray.h"
+#include "include/disk.h"
 #include "include/fat12.h"
+#include "include/dirscan.h"
 
 /*----------------------------------------------------------------------------*/
 /* General disk reading */
@@ -45,13 +46,10 @@
  * and the 'dst' array will remain unchanged, with the old data.
  */
 static bool append_sectors(ByteArray* dst,
-                           FILE* disk,
+                           const Disk* disk,
                            const ExtendedBPB* ebpb,
-                           uint16_t lba,
+                           uint32_t lba,
                            uint8_t count) {
-    if (fseek(disk, lba * ebpb->bytes_per_sector, SEEK_SET) != 0)
-        return false;
-
     /* Allocate a new data buffer, without modifying the one on 'dst' */
     size_t new_size = dst->size + (count * ebpb->bytes_per_sector);
     void* new_data  = malloc(new_size);
@@ -64,7 +62,10 @@ static bool append_sectors(ByteArray* dst,
 
     /* Read the new data into the free space of the new data buffer */
     void* free_data = (char*)new_data + dst->size;
-    if (fread(free_data, ebpb->bytes_per_sector, count, disk) != count) {
+    if (!disk_read(disk,
+                   free_data,
+                   count * ebpb->bytes_per_sector,
+                   (uint64_t)lba * ebpb->bytes_per_sector)) {
         free(new_data);
         return false;
     }
@@ -80,12 +81,12 @@ static bool append_sectors(ByteArray* dst,
     return true;
 }
 
-BootSector* read_boot_sector(FILE* disk) {
+BootSector* read_boot_sector(const Disk* disk) {
     BootSector* result = malloc(sizeof(BootSector));
     if (result == NULL)
         return NULL;
 
-    if (fread(result, sizeof(BootSector), 1, disk) <= 0) {
+    if (!disk_read(disk, result, sizeof(BootSector), 0)) {
         free(result);
         return NULL;
     }
@@ -94,19 +95,68 @@ BootSector* read_boot_sector(FILE* disk) {
 }
 
 bool read_sectors(ByteArray* dst,
-                  FILE* disk,
+                  const Disk* disk,
                   const ExtendedBPB* ebpb,
-                  uint16_t lba,
+                  uint32_t lba,
                   uint8_t count) {
     dst->data = NULL;
     dst->size = 0;
     return append_sectors(dst, disk, ebpb, lba, count);
 }
 
+/*
+ * Return true if the specified number is a power of two.
+ */
+static inline bool is_power_of_two(uint32_t x) {
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+enum EFatType get_fat_type(const BootSector* boot_sector) {
+    const ExtendedBPB* ebpb = &boot_sector->ebpb;
+
+    /* The boot sector must start with a short or near jump instruction */
+    const uint8_t* code = (const uint8_t*)boot_sector;
+    if (code[0] != 0xEB && code[0] != 0xE9)
+        return FAT_TYPE_NONE;
+
+    /* See p. 9 of the specification for the valid values of these fields */
+    if (ebpb->bytes_per_sector < 512 || ebpb->bytes_per_sector > 4096 ||
+        !is_power_of_two(ebpb->bytes_per_sector) ||
+        !is_power_of_two(ebpb->sectors_per_cluster) ||
+        ebpb->reserved_sectors == 0 || ebpb->fat_count == 0 ||
+        (ebpb->total_sectors == 0 && ebpb->large_sector_count == 0))
+        return FAT_TYPE_NONE;
+
+    /* FAT32 volumes store the size of the FAT in the extended BPB */
+    if (ebpb->sectors_per_fat == 0)
+        return FAT_TYPE_32;
+
+    const size_t cluster_count = get_cluster_count(ebpb);
+    if (cluster_count < 4085)
+        return FAT_TYPE_12;
+    if (cluster_count < 65525)
+        return FAT_TYPE_16;
+    return FAT_TYPE_32;
+}
+
+const char* get_fat_type_name(enum EFatType type) {
+    switch (type) {
+        case FAT_TYPE_12:
+            return "FAT12";
+        case FAT_TYPE_16:
+            return "FAT16";
+        case FAT_TYPE_32:
+            return "FAT32";
+        default:
+        case FAT_TYPE_NONE:
+            return "None";
+    }
+}
+
 /*----------------------------------------------------------------------------*/
 /* File Allocation Table (FAT) */
 
-bool read_fat(ByteArray* dst, FILE* disk, const ExtendedBPB* ebpb) {
+bool read_fat(ByteArray* dst, const Disk* disk, const ExtendedBPB* ebpb) {
     /* The FAT region starts right after the reserved sectors */
     return read_sectors(dst,
                         disk,
@@ -118,13 +168,11 @@ bool read_fat(ByteArray* dst, FILE* disk, const ExtendedBPB* ebpb) {
 /*----------------------------------------------------------------------------*/
 /* Root directory */
 
-/*
- * Return the LBA address where the root directory starts.
- *
- * The root directory region starts after the reserved sectors and after the
- * FAT(s).
- */
-static inline size_t get_rootdir_start(const ExtendedBPB* ebpb) {
+size_t get_rootdir_start(const ExtendedBPB* ebpb) {
+    /*
+     * The root directory region starts after the reserved sectors and after the
+     * FAT(s).
+     */
     return ebpb->reserved_sectors + ebpb->sectors_per_fat * ebpb->fat_count;
 }
 
@@ -154,11 +202,37 @@ static inline size_t get_rootdir_size(const ExtendedBPB* ebpb) {
  * will return the LBA address of the next one. This is consistent with the
  * behavior of 'get_rootdir_size', which includes the last (partial) one.
  */
-static inline size_t get_data_region_start(const ExtendedBPB* ebpb) {
+size_t get_data_region_start(const ExtendedBPB* ebpb) {
     return get_rootdir_start(ebpb) + get_rootdir_size(ebpb);
 }
 
-DirectoryEntry* read_root_directory(FILE* disk, const ExtendedBPB* ebpb) {
+size_t get_cluster_lba(const ExtendedBPB* ebpb, uint16_t cluster) {
+    /*
+     * Since the first two entries of the FAT are reserved, the first data
+     * cluster is the third one, so we subtract 2 from it before multiplying it
+     * by the 'sectors_per_cluster' field. See p. 14 of the specification.
+     */
+    return get_data_region_start(ebpb) +
+           (size_t)(cluster - 2) * ebpb->sectors_per_cluster;
+}
+
+size_t get_cluster_count(const ExtendedBPB* ebpb) {
+    /*
+     * If the volume has more than 0xFFFF sectors, the 'total_sectors' field is
+     * zero and the real count is stored in 'large_sector_count'.
+     */
+    const size_t total_sectors = (ebpb->total_sectors != 0)
+                                   ? ebpb->total_sectors
+                                   : ebpb->large_sector_count;
+    const size_t data_start    = get_data_region_start(ebpb);
+    if (ebpb->sectors_per_cluster == 0 || total_sectors <= data_start)
+        return 0;
+
+    return (total_sectors - data_start) / ebpb->sectors_per_cluster;
+}
+
+DirectoryEntry* read_root_directory(const Disk* disk,
+                                    const ExtendedBPB* ebpb) {
     const size_t lba_start    = get_rootdir_start(ebpb);
     const size_t size_sectors = get_rootdir_size(ebpb);
 
@@ -172,19 +246,16 @@ DirectoryEntry* read_root_directory(FILE* disk, const ExtendedBPB* ebpb) {
 /*----------------------------------------------------------------------------*/
 /* Files */
 
-/*
- * Return the cluster number that is linked to the specified cluster in a 12-bit
- * File Allocation Table.
- */
-static inline uint16_t fat12_get_linked_cluster(ByteArray fat,
-                                                uint16_t cluster) {
+uint16_t fat12_get_linked_cluster(ByteArray fat, uint16_t cluster) {
     /*
      * Since each entry in the FAT is 12 bits (i.e. 3 nibbles, one byte and
      * half), we need to multiply it by 2/3. We can easily do this by adding
      * half of the cluster, as shown in p. 16 of the specification. Note that
      * this rounds down.
      */
-    const int fat_idx = cluster + (cluster / 2);
+    const size_t fat_idx = cluster + (cluster / 2);
+    if (fat_idx + 1 >= fat.size)
+        return FAT12_CLUSTER_BAD;
 
     const uint8_t byte0 = ((uint8_t*)fat.data)[fat_idx];
     const uint8_t byte1 = ((uint8_t*)fat.data)[fat_idx + 1];
@@ -220,17 +291,131 @@ static inline uint16_t fat12_get_linked_cluster(ByteArray fat,
     }
 }
 
+void fat12_set_linked_cluster(ByteArray fat, uint16_t cluster, uint16_t value) {
+    /* See 'fat12_get_linked_cluster' for the layout of the entries */
+    const size_t fat_idx = cluster + (cluster / 2);
+    if (fat_idx + 1 >= fat.size)
+        return;
+
+    uint8_t* bytes = (uint8_t*)fat.data + fat_idx;
+    if (cluster & 1) {
+        bytes[0] = (uint8_t)((bytes[0] & 0x0F) | (value & 0x0F) << 4);
+        bytes[1] = (uint8_t)(value >> 4);
+    } else {
+        bytes[0] = (uint8_t)value;
+        bytes[1] = (uint8_t)((bytes[1] & 0xF0) | (value >> 8 & 0x0F));
+    }
+}
+
+void get_entry_name(const DirectoryEntry* entry, char* dst) {
+    /* Copy the name, without the trailing padding spaces */
+    size_t name_len = 8;
+    while (name_len > 0 && entry->name[name_len - 1] == ' ')
+        name_len--;
+    memcpy(dst, entry->name, name_len);
+
+    /*
+     * The value 0x05 is used in the first byte to represent a real 0xE5 byte,
+     * since 0xE5 marks deleted entries. See p. 23 of the specification.
+     */
+    if (name_len > 0 && (uint8_t)dst[0] == 0x05)
+        dst[0] = (char)0xE5;
+
+    /* Append the extension, if any */
+    size_t ext_len = 3;
+    while (ext_len > 0 && entry->name[8 + ext_len - 1] == ' ')
+        ext_len--;
+    if (ext_len > 0) {
+        dst[name_len++] = '.';
+        memcpy(&dst[name_len], &entry->name[8], ext_len);
+        name_len += ext_len;
+    }
+
+    dst[name_len] = '\0';
+}
+
+int64_t fat_timestamp_to_unix(uint16_t date, uint16_t time) {
+    /*
+     * The date is stored as 7 bits for the year (relative to 1980), 4 bits for
+     * the month (1-12) and 5 bits for the day (1-31). The time is stored as 5
+     * bits for the hours, 6 bits for the minutes and 5 bits for the seconds,
+     * with a granularity of 2 seconds.
+     */
+    int64_t year          = 1980 + (date >> 9);
+    const int64_t month   = (date >> 5) & 0xF;
+    const int64_t day     = date & 0x1F;
+    const int64_t hours   = time >> 11;
+    const int64_t minutes = (time >> 5) & 0x3F;
+    const int64_t seconds = (time & 0x1F) * 2;
+
+    /* Dates without a valid month or day are treated as the FAT epoch */
+    if (month < 1 || month > 12 || day < 1)
+        return fat_timestamp_to_unix(0x21, 0);
+
+    /*
+     * Number of days since the UNIX epoch, using a year that starts in March,
+     * so the leap day is the last day of the year.
+     */
+    if (month <= 2)
+        year--;
+    const int64_t era         = year / 400;
+    const int64_t year_of_era = year - era * 400;
+    const int64_t day_of_year =
+      (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const int64_t day_of_era =
+      year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    const int64_t days = era * 146097 + day_of_era - 719468;
+
+    return days * 86400 + hours * 3600 + minutes * 60 + seconds;
+}
+
+void unix_to_fat_timestamp(int64_t timestamp, uint16_t* date, uint16_t* time) {
+    const int64_t min_timestamp = fat_timestamp_to_unix(0x21, 0);
+    const int64_t max_timestamp = fat_timestamp_to_unix(0xFF9F, 0xBF7D);
+    if (timestamp < min_timestamp)
+        timestamp = min_timestamp;
+    if (timestamp > max_timestamp)
+        timestamp = max_timestamp;
+
+    const int64_t days    = timestamp / 86400;
+    const int64_t seconds = timestamp % 86400;
+
+    /* Inverse of the calculation in 'fat_timestamp_to_unix' */
+    const int64_t shifted     = days + 719468;
+    const int64_t era         = shifted / 146097;
+    const int64_t day_of_era  = shifted - era * 146097;
+    const int64_t year_of_era = (day_of_era - day_of_era / 1460 +
+                                 day_of_era / 36524 - day_of_era / 146096) /
+                                365;
+    const int64_t day_of_year = day_of_era - (365 * year_of_era +
+                                              year_of_era / 4 -
+                                              year_of_era / 100);
+    const int64_t month_index = (5 * day_of_year + 2) / 153;
+    const int64_t day         = day_of_year - (153 * month_index + 2) / 5 + 1;
+    const int64_t month =
+      (month_index < 10) ? month_index + 3 : month_index - 9;
+    const int64_t year = year_of_era + era * 400 + (month <= 2);
+
+    *date = (uint16_t)((year - 1980) << 9 | month << 5 | day);
+    *time = (uint16_t)((seconds / 3600) << 11 | ((seconds / 60) % 60) << 5 |
+                       (seconds % 60) / 2);
+}
+
 DirectoryEntry* search_entry(DirectoryEntry* arr,
                              size_t size,
                              const char* name) {
-    for (size_t i = 0; i < size; i++)
-        if (memcmp(name, arr[i].name, sizeof(arr[i].name)) == 0)
-            return &arr[i];
+    DirScan scan;
+    dirscan_init(&scan, arr, size, DIRENT_LIVE);
+
+    const DirectoryEntry* entry;
+    while ((entry = dirscan_next(&scan)) != NULL)
+        if (memcmp(name, entry->name, sizeof(entry->name)) == 0)
+            return &arr[entry - arr];
     return NULL;
 }
 
 bool read_file(ByteArray* dst,
-               FILE* disk,
+               const Disk* disk,
                const ExtendedBPB* ebpb,
                ByteArray fat,
                const DirectoryEntry* file) {
@@ -251,7 +436,20 @@ bool read_file(ByteArray* dst,
      */
     uint16_t current_cluster = file->first_cluster_low;
 
-    while (current_cluster < 0xFF8) {
+    /*
+     * A valid chain can't be longer than the number of clusters in the volume,
+     * so longer chains must contain a cycle.
+     */
+    const size_t max_clusters = get_cluster_count(ebpb);
+    size_t cluster_count      = 0;
+
+    while (fat12_is_data_cluster(current_cluster)) {
+        if (++cluster_count > max_clusters) {
+            free(dst->data);
+            dst->data = NULL;
+            return false;
+        }
+
         /*
          * As explained above, the cluster number that we have is used to
          * calculate the index in the FAT, not the sector number in the disk.
@@ -0,0 +1,307 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Needed for 'fnmatch' */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fnmatch.h>
+
+#include "include/bytearray.h"
+#include "include/disk.h"
+#include "include/fat12.h"
+#include "include/tree.h"
+#include "include/util.h"
+#include "include/find.h"
+
+/*
+ * State of 'find_run', shared by the tree visitor.
+ */
+typedef struct {
+    FILE* out;
+    const FindQuery* query;
+} FindState;
+
+/*----------------------------------------------------------------------------*/
+/* Parsing */
+
+/*
+ * Parse a size with an optional "k", "M" or "G" suffix, in bytes.
+ */
+static bool parse_size(const char* str, uint64_t* dst) {
+    if (!isdigit((unsigned char)*str))
+        return false;
+
+    char* endptr;
+    errno = 0;
+    const unsigned long long value = strtoull(str, &endptr, 10);
+    if (errno != 0)
+        return false;
+
+    uint64_t multiplier = 1;
+    if (strcmp(endptr, "k") == 0)
+        multiplier = 1024;
+    else if (strcmp(endptr, "M") == 0)
+        multiplier = 1024 * 1024;
+    else if (strcmp(endptr, "G") == 0)
+        multiplier = 1024 * 1024 * 1024;
+    else if (*endptr != '\0')
+        return false;
+
+    if (value > UINT64_MAX / multiplier)
+        return false;
+
+    *dst = value * multiplier;
+    return true;
+}
+
+/*
+ * Parse a "YYYY-MM-DD" or "YYYY-MM-DDTHH:MM:SS" date into a packed FAT date and
+ * time. See the 'FindQuery' structure.
+ */
+static bool parse_date(const char* str, uint32_t* dst) {
+    unsigned year, month, day, hours = 0, minutes = 0, seconds = 0;
+    int len = 0;
+
+    if (sscanf(str, "%4u-%2u-%2u%n", &year, &month, &day, &len) != 3)
+        return false;
+    if (str[len] == 'T' || str[len] == ' ') {
+        const char* time_str = &str[len + 1];
+        if (sscanf(time_str,
+                   "%2u:%2u:%2u%n",
+                   &hours,
+                   &minutes,
+                   &seconds,
+                   &len) != 3)
+            return false;
+        str = time_str;
+    }
+    if (str[len] != '\0')
+        return false;
+
+    if (year < 1980 || year > 2107 || month < 1 || month > 12 || day < 1 ||
+        day > 31 || hours > 23 || minutes > 59 || seconds > 59)
+        return false;
+
+    /* See 'fat_timestamp_to_unix' for the format */
+    const uint32_t date = (year - 1980) << 9 | month << 5 | day;
+    const uint32_t time = hours << 11 | minutes << 5 | seconds / 2;
+    *dst                = date << 16 | time;
+    return true;
+}
+
+static bool parse_attributes(const char* str, uint8_t* dst) {
+    *dst = 0;
+    for (; *str != '\0'; str++) {
+        switch (toupper((unsigned char)*str)) {
+            case 'R':
+                *dst |= ATTR_READ_ONLY;
+                break;
+            case 'H':
+                *dst |= ATTR_HIDDEN;
+                break;
+            case 'S':
+                *dst |= ATTR_SYSTEM;
+                break;
+            case 'A':
+                *dst |= ATTR_ARCHIVE;
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+bool find_parse_query(FindQuery* query, int argc, char** argv) {
+    query->start_path = "/";
+    query->name_glob  = NULL;
+    query->type       = FIND_TYPE_ANY;
+    query->attributes = 0;
+    query->min_size   = 0;
+    query->max_size   = UINT64_MAX;
+    query->after      = 0;
+    query->before     = UINT32_MAX;
+
+    int i = 0;
+    if (i < argc && argv[i][0] != '-')
+        query->start_path = argv[i++];
+
+    for (; i < argc; i += 2) {
+        const char* option = argv[i];
+        if (i + 1 >= argc) {
+            ERR("Missing argument for '%s'.", option);
+            goto error;
+        }
+        const char* value = argv[i + 1];
+
+        bool valid = true;
+        if (strcmp(option, "-name") == 0) {
+            /* The names are stored in upper case */
+            const size_t len = strlen(value);
+            free(query->name_glob);
+            query->name_glob = malloc(len + 1);
+            if (query->name_glob == NULL)
+                goto error;
+            for (size_t j = 0; j <= len; j++)
+                query->name_glob[j] = (char)toupper((unsigned char)value[j]);
+        } else if (strcmp(option, "-type") == 0) {
+            if (strcmp(value, "f") == 0)
+                query->type = FIND_TYPE_FILE;
+            else if (strcmp(value, "d") == 0)
+                query->type = FIND_TYPE_DIRECTORY;
+            else
+                valid = false;
+        } else if (strcmp(option, "-size") == 0) {
+            uint64_t size;
+            if (value[0] == '+') {
+                valid = parse_size(&value[1], &size) && size < UINT64_MAX;
+                if (valid)
+                    query->min_size = size + 1;
+            } else if (value[0] == '-') {
+                valid = parse_size(&value[1], &size) && size > 0;
+                if (valid)
+                    query->max_size = size - 1;
+            } else {
+                valid = parse_size(value, &size);
+                if (valid)
+                    query->min_size = query->max_size = size;
+            }
+        } else if (strcmp(option, "-after") == 0) {
+            valid = parse_date(value, &query->after);
+        } else if (strcmp(option, "-before") == 0) {
+            valid = parse_date(value, &query->before);
+        } else if (strcmp(option, "-attr") == 0) {
+            valid = parse_attributes(value, &query->attributes);
+        } else {
+            ERR("Unknown option: '%s'", option);
+            goto error;
+        }
+
+        if (!valid) {
+            ERR("Invalid value for '%s': '%s'", option, value);
+            goto error;
+        }
+    }
+
+    return true;
+
+error:
+    find_free_query(query);
+    return false;
+}
+
+void find_free_query(FindQuery* query) {
+    free(query->name_glob);
+    query->name_glob = NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Searching */
+
+/*
+ * Print a hit. The timestamp is only decoded here, the predicates compare the
+ * packed values.
+ */
+static void print_hit(FILE* out,
+                      const char* path,
+                      const DirectoryEntry* entry) {
+    const uint16_t date = entry->modified_date;
+    const uint16_t time = entry->modified_time;
+
+    const bool is_dir = (entry->attributes & ATTR_DIRECTORY) != 0;
+    fprintf(out,
+            "%04u-%02u-%02u %02u:%02u:%02u %10" PRIu32 " %s%s\n",
+            1980 + (date >> 9),
+            (date >> 5) & 0xF,
+            date & 0x1F,
+            time >> 11,
+            (time >> 5) & 0x3F,
+            (time & 0x1F) * 2,
+            entry->size,
+            path,
+            is_dir ? "/" : "");
+}
+
+static bool find_visit(void* ctx,
+                       const char* path,
+                       const DirectoryEntry* entry) {
+    const FindState* state = ctx;
+    const FindQuery* query = state->query;
+
+    /* The cheapest predicates are evaluated first */
+    const bool is_dir = (entry->attributes & ATTR_DIRECTORY) != 0;
+    if ((query->type == FIND_TYPE_FILE && is_dir) ||
+        (query->type == FIND_TYPE_DIRECTORY && !is_dir))
+        return true;
+
+    if ((entry->attributes & query->attributes) != query->attributes)
+        return true;
+
+    if (entry->size < query->min_size || entry->size > query->max_size)
+        return true;
+
+    const uint32_t timestamp =
+      (uint32_t)entry->modified_date << 16 | entry->modified_time;
+    if (timestamp < query->after || timestamp >= query->before)
+        return true;
+
+    /* The last component of the path is the name of the entry */
+    if (query->name_glob != NULL &&
+        fnmatch(query->name_glob, strrchr(path, '/') + 1, 0) != 0)
+        return true;
+
+    print_hit(state->out, path, entry);
+    return true;
+}
+
+bool find_run(FILE* out, const Disk* disk, const FindQuery* query) {
+    BootSector* boot_sector = read_boot_sector(disk);
+    if (boot_sector == NULL)
+        return false;
+
+    ByteArray fat;
+    if (!read_fat(&fat, disk, &boot_sector->ebpb)) {
+        free(boot_sector);
+        return false;
+    }
+
+    FindState state = {
+        .out   = out,
+        .query = query,
+    };
+
+    const bool success = tree_walk_at(disk,
+                                      &boot_sector->ebpb,
+                                      fat,
+                                      query->start_path,
+                                      find_visit,
+                                      &state);
+
+    free(fat.data);
+    free(boot_sector);
+    return success;
+}
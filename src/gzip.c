@@ -0,0 +1,550 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * The checkpoint index is based on the 'zran.c' example of zlib, by Mark Adler.
+ */
+
+/* Needed for 'pread', 'fstat' and 'mmap' */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h> /* rename, remove */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "include/util.h"
+#include "include/disk.h"
+#include "include/gzip.h"
+
+/*
+ * Size of the window used by deflate, which needs to be stored in each
+ * checkpoint, and size of the buffers for reading compressed data and for
+ * discarding decompressed data.
+ */
+#define WINDOW_SIZE  32768
+#define INPUT_SIZE   (64 * 1024)
+#define DISCARD_SIZE (64 * 1024)
+
+#define GZIP_INDEX_MAGIC   "DFATGZX"
+#define GZIP_INDEX_VERSION 1
+
+/*
+ * Header of the cached index file, followed by 'point_count' checkpoints.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t span;
+
+    /* Used for detecting stale indexes */
+    uint64_t file_size;
+    int64_t file_mtime_sec;
+    int64_t file_mtime_nsec;
+
+    uint64_t uncompressed_size;
+    uint64_t point_count;
+} GzipIndexHeader;
+STATIC_ASSERT(sizeof(GzipIndexHeader) == 56);
+
+/*
+ * State of the decompressor at a deflate block boundary. The 'in' offset is
+ * the position in the compressed file, and 'bits' is the number of bits of the
+ * previous byte that belong to the new block.
+ */
+typedef struct {
+    uint64_t out;
+    uint64_t in;
+    uint32_t bits;
+    uint32_t reserved;
+    uint8_t window[WINDOW_SIZE];
+} GzipCheckpoint;
+STATIC_ASSERT(sizeof(GzipCheckpoint) % 8 == 0);
+
+/*
+ * Context of the gzip backend.
+ */
+typedef struct {
+    int fd;
+    pthread_mutex_t lock;
+
+    /* Index, either mapped from the cache or built in memory */
+    GzipIndexHeader* index;
+    size_t index_size;
+    bool index_mapped;
+
+    /* Decompressor, reused by consecutive reads */
+    z_stream strm;
+    bool strm_initialized;
+    bool strm_valid;
+    uint64_t strm_in;  /* Offset of the next compressed byte to read */
+    uint64_t strm_out; /* Offset of the next decompressed byte */
+
+    uint8_t input[INPUT_SIZE];
+    uint8_t discard[DISCARD_SIZE];
+} GzipDisk;
+
+static inline GzipCheckpoint* get_checkpoints(const GzipIndexHeader* index) {
+    return (GzipCheckpoint*)(index + 1);
+}
+
+/*----------------------------------------------------------------------------*/
+/* Building the index */
+
+/*
+ * Append a checkpoint to the index being built. The window is circular, and
+ * 'left' is the number of unused bytes at its end.
+ */
+static bool add_checkpoint(GzipIndexHeader** index,
+                           size_t* capacity,
+                           uint64_t in,
+                           uint64_t out,
+                           int bits,
+                           const uint8_t* window,
+                           size_t left) {
+    const size_t used = sizeof(GzipIndexHeader) +
+                        (*index)->point_count * sizeof(GzipCheckpoint);
+    if (used + sizeof(GzipCheckpoint) > *capacity) {
+        const size_t new_capacity = *capacity * 2;
+        GzipIndexHeader* new_index = realloc(*index, new_capacity);
+        if (new_index == NULL)
+            return false;
+        *index    = new_index;
+        *capacity = new_capacity;
+    }
+
+    GzipCheckpoint* point = &get_checkpoints(*index)[(*index)->point_count++];
+    point->out            = out;
+    point->in             = in;
+    point->bits           = (uint32_t)bits;
+    point->reserved       = 0;
+
+    /* Store the window in order, oldest byte first */
+    if (left > 0)
+        memcpy(point->window, &window[WINDOW_SIZE - left], left);
+    if (left < WINDOW_SIZE)
+        memcpy(&point->window[left], window, WINDOW_SIZE - left);
+
+    return true;
+}
+
+/*
+ * Decompress the whole gzip file, storing a checkpoint every 'GZIP_SPAN'
+ * bytes. On success, the caller is responsible for freeing '*dst'.
+ */
+static bool build_index(GzipIndexHeader** dst, int fd, const struct stat* st) {
+    size_t capacity        = sizeof(GzipIndexHeader) + sizeof(GzipCheckpoint);
+    GzipIndexHeader* index = calloc(1, capacity);
+    uint8_t* input         = malloc(INPUT_SIZE);
+    uint8_t* window        = calloc(1, WINDOW_SIZE);
+    if (index == NULL || input == NULL || window == NULL) {
+        free(window);
+        free(input);
+        free(index);
+        return false;
+    }
+
+    memcpy(index->magic, GZIP_INDEX_MAGIC, sizeof(GZIP_INDEX_MAGIC));
+    index->version         = GZIP_INDEX_VERSION;
+    index->span            = GZIP_SPAN;
+    index->file_size       = (uint64_t)st->st_size;
+    index->file_mtime_sec  = (int64_t)st->st_mtim.tv_sec;
+    index->file_mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+
+    /* Automatic zlib or gzip header detection, 32KiB window */
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, 47) != Z_OK) {
+        free(window);
+        free(input);
+        free(index);
+        return false;
+    }
+
+    uint64_t total_in = 0, total_out = 0, last = 0;
+    bool success      = false;
+    int ret           = Z_OK;
+    strm.avail_out    = 0;
+
+    do {
+        const ssize_t bytes_read =
+          pread(fd, input, INPUT_SIZE, (off_t)total_in);
+        if (bytes_read <= 0)
+            goto done;
+        strm.next_in  = input;
+        strm.avail_in = (uInt)bytes_read;
+
+        do {
+            if (strm.avail_out == 0) {
+                strm.next_out  = window;
+                strm.avail_out = WINDOW_SIZE;
+            }
+
+            /* Stop at the end of each deflate block, see 'zlib.h' */
+            total_in += strm.avail_in;
+            total_out += strm.avail_out;
+            ret = inflate(&strm, Z_BLOCK);
+            total_in -= strm.avail_in;
+            total_out -= strm.avail_out;
+
+            if (ret != Z_OK && ret != Z_STREAM_END)
+                goto done;
+            if (ret == Z_STREAM_END)
+                break;
+
+            /*
+             * Bit 7 of 'data_type' is set at the end of a block, and bit 6 is
+             * set after the last block. The lower bits contain the number of
+             * unused bits in the last byte of input.
+             */
+            if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+                (total_out == 0 || total_out - last >= GZIP_SPAN)) {
+                if (!add_checkpoint(&index,
+                                    &capacity,
+                                    total_in,
+                                    total_out,
+                                    strm.data_type & 7,
+                                    window,
+                                    strm.avail_out))
+                    goto done;
+                last = total_out;
+            }
+        } while (strm.avail_in != 0);
+    } while (ret != Z_STREAM_END);
+
+    /* Concatenated gzip members are not supported */
+    if (strm.avail_in != 0 || total_in < (uint64_t)st->st_size)
+        goto done;
+
+    index->uncompressed_size = total_out;
+    success                  = (index->point_count > 0);
+
+done:
+    inflateEnd(&strm);
+    free(window);
+    free(input);
+    if (success)
+        *dst = index;
+    else
+        free(index);
+    return success;
+}
+
+/*
+ * Write the index to the specified path, through a temporary file.
+ */
+static bool write_index(const char* index_path, const GzipIndexHeader* index) {
+    const size_t size = sizeof(GzipIndexHeader) +
+                        index->point_count * sizeof(GzipCheckpoint);
+
+    const size_t index_path_len = strlen(index_path);
+    char* tmp_path = malloc(index_path_len + STRLEN(".tmp") + 1);
+    if (tmp_path == NULL)
+        return false;
+    memcpy(tmp_path, index_path, index_path_len);
+    memcpy(&tmp_path[index_path_len], ".tmp", STRLEN(".tmp") + 1);
+
+    FILE* fp     = fopen(tmp_path, "wb");
+    bool success = (fp != NULL);
+    if (success) {
+        success = (fwrite(index, size, 1, fp) == 1);
+        if (fclose(fp) != 0)
+            success = false;
+        if (success)
+            success = (rename(tmp_path, index_path) == 0);
+        else
+            remove(tmp_path);
+    }
+
+    free(tmp_path);
+    return success;
+}
+
+/*
+ * Map the cached index in the specified path, if it's still valid for the
+ * compressed file.
+ */
+static bool map_index(GzipDisk* gz,
+                      const char* index_path,
+                      const struct stat* st) {
+    const int fd = open(index_path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat index_st;
+    if (fstat(fd, &index_st) != 0 ||
+        (size_t)index_st.st_size < sizeof(GzipIndexHeader)) {
+        close(fd);
+        return false;
+    }
+
+    const size_t size = (size_t)index_st.st_size;
+    void* map         = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    const GzipIndexHeader* index = map;
+    if (memcmp(index->magic, GZIP_INDEX_MAGIC, sizeof(GZIP_INDEX_MAGIC)) != 0 ||
+        index->version != GZIP_INDEX_VERSION ||
+        index->file_size != (uint64_t)st->st_size ||
+        index->file_mtime_sec != (int64_t)st->st_mtim.tv_sec ||
+        index->file_mtime_nsec != (int64_t)st->st_mtim.tv_nsec ||
+        index->point_count == 0 ||
+        index->point_count > (size - sizeof(GzipIndexHeader)) /
+                               sizeof(GzipCheckpoint)) {
+        munmap(map, size);
+        return false;
+    }
+
+    gz->index        = map;
+    gz->index_size   = size;
+    gz->index_mapped = true;
+    return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Reading */
+
+/*
+ * Return the last checkpoint before the specified uncompressed offset.
+ */
+static const GzipCheckpoint* find_checkpoint(const GzipDisk* gz,
+                                             uint64_t offset) {
+    const GzipCheckpoint* points = get_checkpoints(gz->index);
+
+    size_t lo = 0, hi = gz->index->point_count;
+    while (hi - lo > 1) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (points[mid].out <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return &points[lo];
+}
+
+/*
+ * Prepare the decompressor for reading from the specified checkpoint.
+ */
+static bool seek_checkpoint(GzipDisk* gz, const GzipCheckpoint* point) {
+    gz->strm_valid = false;
+
+    /* Raw deflate data, the gzip header was already skipped */
+    if (!gz->strm_initialized) {
+        memset(&gz->strm, 0, sizeof(gz->strm));
+        if (inflateInit2(&gz->strm, -15) != Z_OK)
+            return false;
+        gz->strm_initialized = true;
+    } else if (inflateReset(&gz->strm) != Z_OK) {
+        return false;
+    }
+
+    gz->strm_in       = point->in;
+    gz->strm.avail_in = 0;
+
+    /* The block might start in the middle of the previous byte */
+    if (point->bits > 0) {
+        uint8_t byte;
+        if (pread(gz->fd, &byte, 1, (off_t)point->in - 1) != 1)
+            return false;
+        const int bits = (int)point->bits;
+        if (inflatePrime(&gz->strm, bits, byte >> (8 - bits)) != Z_OK)
+            return false;
+    }
+
+    if (inflateSetDictionary(&gz->strm, point->window, WINDOW_SIZE) != Z_OK)
+        return false;
+
+    gz->strm_out   = point->out;
+    gz->strm_valid = true;
+    return true;
+}
+
+/*
+ * Decompress the next 'size' bytes into 'dst'.
+ */
+static bool inflate_bytes(GzipDisk* gz, void* dst, size_t size) {
+    uint8_t* ptr = dst;
+
+    while (size > 0) {
+        const uInt chunk  = (size < UINT_MAX) ? (uInt)size : UINT_MAX;
+        gz->strm.next_out  = ptr;
+        gz->strm.avail_out = chunk;
+
+        while (gz->strm.avail_out > 0) {
+            if (gz->strm.avail_in == 0) {
+                const ssize_t bytes_read =
+                  pread(gz->fd, gz->input, INPUT_SIZE, (off_t)gz->strm_in);
+                if (bytes_read <= 0)
+                    return false;
+                gz->strm.next_in  = gz->input;
+                gz->strm.avail_in = (uInt)bytes_read;
+                gz->strm_in += (uint64_t)bytes_read;
+            }
+
+            const int ret = inflate(&gz->strm, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END && gz->strm.avail_out > 0)
+                return false;
+            if (ret != Z_OK && ret != Z_STREAM_END)
+                return false;
+        }
+
+        ptr += chunk;
+        size -= chunk;
+        gz->strm_out += chunk;
+    }
+
+    return true;
+}
+
+static bool read_locked(GzipDisk* gz, void* dst, size_t size, uint64_t offset) {
+    if (offset > gz->index->uncompressed_size ||
+        size > gz->index->uncompressed_size - offset)
+        return false;
+
+    /*
+     * If the current decompressor is already behind the offset, and there is
+     * no closer checkpoint, keep decompressing from there.
+     */
+    const GzipCheckpoint* point = find_checkpoint(gz, offset);
+    if (!gz->strm_valid || gz->strm_out > offset || point->out > gz->strm_out)
+        if (!seek_checkpoint(gz, point))
+            return false;
+
+    while (gz->strm_out < offset) {
+        const uint64_t remaining = offset - gz->strm_out;
+        const size_t chunk =
+          (remaining < DISCARD_SIZE) ? (size_t)remaining : DISCARD_SIZE;
+        if (!inflate_bytes(gz, gz->discard, chunk)) {
+            gz->strm_valid = false;
+            return false;
+        }
+    }
+
+    if (!inflate_bytes(gz, dst, size)) {
+        gz->strm_valid = false;
+        return false;
+    }
+
+    return true;
+}
+
+static bool gzip_read(void* ctx, void* dst, size_t size, uint64_t offset) {
+    GzipDisk* gz = ctx;
+
+    pthread_mutex_lock(&gz->lock);
+    const bool result = read_locked(gz, dst, size, offset);
+    pthread_mutex_unlock(&gz->lock);
+
+    return result;
+}
+
+static void gzip_close(void* ctx) {
+    GzipDisk* gz = ctx;
+
+    if (gz->strm_initialized)
+        inflateEnd(&gz->strm);
+
+    if (gz->index_mapped)
+        munmap(gz->index, gz->index_size);
+    else
+        free(gz->index);
+
+    pthread_mutex_destroy(&gz->lock);
+    free(gz);
+}
+
+static const DiskBackend gzip_backend = {
+    .read  = gzip_read,
+    .close = gzip_close,
+};
+
+/*----------------------------------------------------------------------------*/
+/* Public functions */
+
+bool is_gzip_file(int fd) {
+    uint8_t magic[2];
+    return pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+           magic[0] == 0x1F && magic[1] == 0x8B;
+}
+
+bool gzip_disk_open(Disk* disk, const char* path) {
+    struct stat st;
+    if (fstat(disk->fd, &st) != 0)
+        return false;
+
+    GzipDisk* gz = calloc(1, sizeof(GzipDisk));
+    if (gz == NULL)
+        return false;
+    gz->fd = disk->fd;
+
+    const size_t path_len = strlen(path);
+    char* index_path      = malloc(path_len + STRLEN(".gzidx") + 1);
+    if (index_path == NULL) {
+        free(gz);
+        return false;
+    }
+    memcpy(index_path, path, path_len);
+    memcpy(&index_path[path_len], ".gzidx", STRLEN(".gzidx") + 1);
+
+    /*
+     * Use the cached index if possible. Otherwise, build it and try to cache
+     * it, although the image can still be read if the cache can't be written.
+     */
+    if (!map_index(gz, index_path, &st)) {
+        if (!build_index(&gz->index, disk->fd, &st)) {
+            free(index_path);
+            free(gz);
+            return false;
+        }
+
+        gz->index_size = sizeof(GzipIndexHeader) +
+                         gz->index->point_count * sizeof(GzipCheckpoint);
+        if (!write_index(index_path, gz->index))
+            ERR("Warning: Could not write gzip index '%s': %s",
+                index_path,
+                strerror(errno));
+    }
+    free(index_path);
+
+    if (pthread_mutex_init(&gz->lock, NULL) != 0) {
+        if (gz->index_mapped)
+            munmap(gz->index, gz->index_size);
+        else
+            free(gz->index);
+        free(gz);
+        return false;
+    }
+
+    disk->size        = gz->index->uncompressed_size;
+    disk->backend     = &gzip_backend;
+    disk->backend_ctx = gz;
+    return true;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEFRAG_H_
+#define DEFRAG_H_ 1
+
+#include <stdbool.h>
+#include <stdio.h> /* FILE */
+
+#include "disk.h"
+
+/*
+ * Relocate the cluster chain of every file and directory in the specified
+ * volume of the 'diskimg_path' image, so each one is stored in a contiguous run
+ * of clusters, in the same order as a depth-first traversal of the tree. The
+ * number of fragments before and after the relocation is printed to 'out'.
+ *
+ * The defragmented image is written to a temporary file next to the original,
+ * which is only replaced (with an atomic rename) after everything was written
+ * and synced. If 'dry_run' is true, only the fragment counts are printed.
+ *
+ * Bad clusters and lost clusters (allocated, but not reachable from the tree)
+ * are not moved. If any directory can't be read, nothing is written.
+ *
+ * Since the image is replaced with a rename, it must be a regular file with a
+ * single hard link: block devices and symbolic links are refused. The owner and
+ * the permissions of the original are kept.
+ */
+bool defrag_image(FILE* out,
+                  const char* diskimg_path,
+                  const Disk* volume,
+                  bool dry_run);
+
+#endif /* DEFRAG_H_ */
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DIFF_H_
+#define DIFF_H_ 1
+
+#include <stdbool.h>
+#include <stdio.h> /* FILE */
+
+#include "disk.h"
+
+/*
+ * Compare the FAT volumes in the specified disk images, and print the
+ * differences to the 'out' file.
+ *
+ * The boot sectors and the File Allocation Tables are compared first, then the
+ * directory trees are compared by the metadata of their entries. The contents
+ * of a file are only read and hashed when its metadata or its cluster chain
+ * differ between both images. Each changed path is printed in a line with one
+ * of the following prefixes:
+ *
+ *   A  The file or directory was added.
+ *   D  The file or directory was deleted.
+ *   M  The contents of the file were modified.
+ *   T  Only the metadata (attributes or timestamps) of the entry changed.
+ *   R  The file or directory was moved or renamed, without modifying it.
+ *
+ * Returns false if any of the images could not be read.
+ */
+bool diff_images(FILE* out, const Disk* disk_a, const Disk* disk_b);
+
+#endif /* DIFF_H_ */
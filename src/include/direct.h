@@ -0,0 +1,51 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DIRECT_H_
+#define DIRECT_H_ 1
+
+#include <stdbool.h>
+
+#include "disk.h"
+
+/*
+ * Size of the aligned blocks read from the image, and number of blocks kept in
+ * the buffer pool of each disk.
+ */
+#define DIRECT_BLOCK_SIZE  (1024 * 1024)
+#define DIRECT_POOL_BLOCKS 8
+
+/*
+ * Alignment of the offsets, sizes and buffers used for direct reads. It's a
+ * multiple of the logical block size of common devices (512 or 4096 bytes).
+ */
+#define DIRECT_ALIGNMENT 4096
+
+/*
+ * Open the image in 'path' again with 'O_DIRECT', bypassing the page cache, and
+ * set the backend of 'disk' accordingly.
+ *
+ * The image is read in aligned blocks of 'DIRECT_BLOCK_SIZE' bytes into a
+ * fixed pool of buffers, allocated up front with huge pages when possible, so
+ * reading a whole image doesn't increase the memory usage of the system.
+ * Unaligned reads are served from the pool, while big aligned reads go
+ * directly to the destination.
+ */
+bool direct_disk_open(Disk* disk, const char* path);
+
+#endif /* DIRECT_H_ */
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DIRSCAN_H_
+#define DIRSCAN_H_ 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fat12.h"
+
+/*
+ * Classes of directory entries, used as a bit mask for selecting the entries
+ * returned by 'dirscan_classify'. The free entries after the end-of-directory
+ * marker are never returned.
+ */
+enum EDirentClass {
+    DIRENT_DELETED      = 1 << 0,
+    DIRENT_LONG_NAME    = 1 << 1, /* Includes the LFN entries */
+    DIRENT_VOLUME_LABEL = 1 << 2,
+    DIRENT_DIRECTORY    = 1 << 3, /* Includes the '.' and '..' entries */
+    DIRENT_FILE         = 1 << 4,
+};
+
+/*
+ * Entries that refer to existing files or directories.
+ */
+#define DIRENT_LIVE (DIRENT_DIRECTORY | DIRENT_FILE)
+
+/*
+ * Number of entries classified at once by 'dirscan_next'.
+ */
+#define DIRSCAN_BATCH 64
+
+/*
+ * Iterator over the entries of a directory that belong to some classes. See
+ * 'dirscan_init' and 'dirscan_next'.
+ */
+typedef struct {
+    const DirectoryEntry* arr;
+    size_t size; /* Reduced to the position of the end marker, once found */
+    size_t pos;  /* First entry that hasn't been classified yet */
+    unsigned classes;
+
+    uint32_t batch[DIRSCAN_BATCH];
+    size_t batch_count;
+    size_t batch_pos;
+} DirScan;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Classify the 'size' entries in 'arr', stopping at the first free entry (i.e.
+ * the end-of-directory marker). The indices of the entries whose class is in
+ * the 'classes' mask are written to 'dst', in order, and their count is
+ * returned. The 'dst' array must have room for 'size' indices, but it can be
+ * NULL if 'classes' is zero.
+ *
+ * If 'end' is not NULL, it's set to the index of the end marker, or to 'size'
+ * if there isn't one.
+ *
+ * When SSE2 is available, 16 entries are classified per iteration.
+ */
+size_t dirscan_classify(const DirectoryEntry* arr,
+                        size_t size,
+                        unsigned classes,
+                        uint32_t* dst,
+                        size_t* end);
+
+/*
+ * Initialize an iterator over the entries of 'arr' whose class is in the
+ * 'classes' mask.
+ */
+void dirscan_init(DirScan* scan,
+                  const DirectoryEntry* arr,
+                  size_t size,
+                  unsigned classes);
+
+/*
+ * Return the next entry of the specified iterator, or NULL if there are no
+ * more entries.
+ */
+const DirectoryEntry* dirscan_next(DirScan* scan);
+
+#endif /* DIRSCAN_H_ */
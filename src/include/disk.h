@@ -0,0 +1,91 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DISK_H_
+#define DISK_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Functions used for reading images that can't be read directly from their
+ * file (e.g. compressed images). The 'offset' received by 'read' is relative
+ * to the start of the whole image. Backends must allow concurrent reads.
+ */
+typedef struct {
+    bool (*read)(void* ctx, void* dst, size_t size, uint64_t offset);
+    void (*close)(void* ctx);
+} DiskBackend;
+
+/*
+ * Disk image, or a region of one (e.g. a partition). All offsets received by
+ * the 'disk_*' functions are relative to the start of the region.
+ *
+ * Reads don't depend on a file position, so the same 'Disk' can be used by
+ * multiple threads at the same time.
+ */
+typedef struct {
+    int fd;          /* File of the image, which might be compressed */
+    uint64_t offset; /* Start of the region, in bytes */
+    uint64_t size;   /* Size of the region, in bytes */
+
+    /* If NULL, the image is read directly from 'fd' */
+    const DiskBackend* backend;
+    void* backend_ctx;
+} Disk;
+
+/*
+ * Flags for 'disk_open'.
+ */
+enum EDiskFlags {
+    /* Read through the 'O_DIRECT' backend in 'direct.h' */
+    DISK_DIRECT_IO = 1 << 0,
+};
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Open the disk image in the specified path for reading. The whole file is used
+ * as the region. Gzip-compressed images are detected and opened through the
+ * backend in 'gzip.h'; otherwise, if 'flags' contains 'DISK_DIRECT_IO', the
+ * image is read without using the page cache. The caller must call
+ * 'disk_close' when done.
+ */
+bool disk_open(Disk* disk, const char* path, unsigned flags);
+
+/*
+ * Close the file and the backend of the specified disk. Regions returned by
+ * 'disk_region' share the file, so they must not be used after closing their
+ * parent.
+ */
+void disk_close(Disk* disk);
+
+/*
+ * Read 'size' bytes at the specified offset of the disk. Returns false if the
+ * read failed, or if the range is not inside the region.
+ */
+bool disk_read(const Disk* disk, void* dst, size_t size, uint64_t offset);
+
+/*
+ * Return a disk representing the region of 'size' bytes at the specified offset
+ * of 'disk'. The region is truncated to the size of its parent.
+ */
+Disk disk_region(const Disk* disk, uint64_t offset, uint64_t size);
+
+#endif /* DISK_H_ */
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPORT_H_
+#define EXPORT_H_ 1
+
+#include <stdbool.h>
+
+#include "disk.h"
+
+/*
+ * Write every file and directory of the specified disk into 'out_fd' as a POSIX
+ * tar (ustar) stream, without extracting them to temporary files.
+ *
+ * The contiguous clusters of each file are copied from the disk image to the
+ * output by the kernel when possible (with 'copy_file_range', 'splice' or
+ * 'sendfile'), falling back to buffered copies when the output doesn't support
+ * them.
+ */
+bool export_tar(int out_fd, const Disk* disk);
+
+/*
+ * Write the files and directories of the specified disk like 'export_tar', but
+ * with 'prefix' prepended to their paths, and without the end of the archive.
+ * Used to write several volumes into the same archive.
+ */
+bool export_tar_entries(int out_fd, const Disk* disk, const char* prefix);
+
+/*
+ * Write the end of a tar archive written with 'export_tar_entries'.
+ */
+bool export_tar_end(int out_fd);
+
+#endif /* EXPORT_H_ */
@@ -21,10 +21,10 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include <stdio.h> /* FILE */
 
 #include "util.h" /* STATIC_ASSERT */
 #include "bytearray.h"
+#include "disk.h"
 
 /*
  * Extended BIOS Parameter Block (EBPB) used by FAT12 and FAT16 since DOS 4.0.
@@ -96,6 +96,51 @@ typedef struct {
 } __attribute__((packed)) DirectoryEntry;
 STATIC_ASSERT(sizeof(DirectoryEntry) == 32);
 
+/*
+ * Bits of the 'DirectoryEntry.attributes' member. Note that 'ATTR_LONG_NAME' is
+ * a combination of bits used by Long File Name (LFN) entries. See p. 23 of the
+ * specification.
+ */
+#define ATTR_READ_ONLY 0x01
+#define ATTR_HIDDEN    0x02
+#define ATTR_SYSTEM    0x04
+#define ATTR_VOLUME_ID 0x08
+#define ATTR_DIRECTORY 0x10
+#define ATTR_ARCHIVE   0x20
+#define ATTR_LONG_NAME 0x0F
+
+/*
+ * Special values of the first byte of 'DirectoryEntry.name'. A free entry
+ * indicates that there are no more allocated entries after it.
+ */
+#define ENTRY_FREE    0x00
+#define ENTRY_DELETED 0xE5
+
+/*
+ * Special values in a 12-bit FAT. Any value greater or equal than
+ * 'FAT12_CLUSTER_EOC' marks the end of a cluster chain.
+ */
+#define FAT12_CLUSTER_FREE 0x000
+#define FAT12_CLUSTER_BAD  0xFF7
+#define FAT12_CLUSTER_EOC  0xFF8
+
+/*
+ * Size of the buffer needed by 'get_entry_name', including the NULL terminator
+ * (i.e. 8 name characters, the dot and 3 extension characters).
+ */
+#define ENTRY_NAME_SIZE 13
+
+/*
+ * Type of a FAT file system, determined by its number of clusters. See p. 14
+ * of the specification.
+ */
+enum EFatType {
+    FAT_TYPE_NONE,
+    FAT_TYPE_12,
+    FAT_TYPE_16,
+    FAT_TYPE_32,
+};
+
 /*----------------------------------------------------------------------------*/
 
 /*
@@ -103,32 +148,42 @@ STATIC_ASSERT(sizeof(DirectoryEntry) == 32);
  */
 
 /*
- * Return a heap-allocated copy of the boot sector in the specified file. The
+ * Return a heap-allocated copy of the boot sector in the specified disk. The
  * returned pointer must be freed by the caller.
  */
-BootSector* read_boot_sector(FILE* disk);
+BootSector* read_boot_sector(const Disk* disk);
 
 /*
- * Read the specified number of sectors from the specified Logical Block Address
- * (LBA) of the specified disk image file. The returned pointer must be freed by
- * the caller.
+ * Return the type of the FAT file system described by the specified boot
+ * sector, or 'FAT_TYPE_NONE' if it doesn't look like a valid FAT boot sector.
  *
- * Note that this function will overwrite the current position in the disk file,
- * so the caller might want to use something like 'ftell' before the call.
+ * Note that only FAT12 volumes can be read by the other functions.
+ */
+enum EFatType get_fat_type(const BootSector* boot_sector);
+
+/*
+ * Return a human-readable name for the specified FAT type.
+ */
+const char* get_fat_type_name(enum EFatType type);
+
+/*
+ * Read the specified number of sectors from the specified Logical Block Address
+ * (LBA) of the specified disk. The returned pointer must be freed by the
+ * caller.
  */
 bool read_sectors(ByteArray* dst,
-                  FILE* disk,
+                  const Disk* disk,
                   const ExtendedBPB* ebpb,
-                  uint16_t lba,
+                  uint32_t lba,
                   uint8_t count);
 
 /*
- * Read the File Allocation Table (FAT) of the specified disk image file.
+ * Read the File Allocation Table (FAT) of the specified disk.
  *
  * The 'data' pointer of the received 'ByteArray' structure will be set to a
  * heap-allocated pointer that the caller must free.
  */
-bool read_fat(ByteArray* dst, FILE* disk, const ExtendedBPB* ebpb);
+bool read_fat(ByteArray* dst, const Disk* disk, const ExtendedBPB* ebpb);
 
 /*
  * Return an array of directory entries for the root directory of the specified
@@ -137,10 +192,76 @@ bool read_fat(ByteArray* dst, FILE* disk, const ExtendedBPB* ebpb);
  *
  * The caller is responsible for freeing the returned pointer.
  */
-DirectoryEntry* read_root_directory(FILE* disk, const ExtendedBPB* ebpb);
+DirectoryEntry* read_root_directory(const Disk* disk,
+                                    const ExtendedBPB* ebpb);
+
+/*
+ * Return the LBA address where the root directory starts.
+ */
+size_t get_rootdir_start(const ExtendedBPB* ebpb);
+
+/*
+ * Return the LBA address of the first sector in the data region, that is, the
+ * first sector of cluster number 2.
+ */
+size_t get_data_region_start(const ExtendedBPB* ebpb);
+
+/*
+ * Return the LBA address of the first sector of the specified data cluster.
+ */
+size_t get_cluster_lba(const ExtendedBPB* ebpb, uint16_t cluster);
+
+/*
+ * Return the number of data clusters in the specified volume. Valid data
+ * clusters range from 2 to 'get_cluster_count(ebpb) + 1' (both included).
+ */
+size_t get_cluster_count(const ExtendedBPB* ebpb);
+
+/*
+ * Return true if the specified cluster number refers to a data cluster, rather
+ * than to a free, bad or end-of-chain marker.
+ */
+static inline bool fat12_is_data_cluster(uint16_t cluster) {
+    return cluster >= 2 && cluster < FAT12_CLUSTER_BAD;
+}
+
+/*
+ * Return the cluster number that is linked to the specified cluster in a 12-bit
+ * File Allocation Table.
+ */
+uint16_t fat12_get_linked_cluster(ByteArray fat, uint16_t cluster);
+
+/*
+ * Set the entry of the specified cluster in a 12-bit File Allocation Table,
+ * keeping the nibble it shares with the adjacent entry. Out-of-range clusters
+ * are ignored.
+ */
+void fat12_set_linked_cluster(ByteArray fat, uint16_t cluster, uint16_t value);
+
+/*
+ * Write the name of the specified directory entry into 'dst', in the usual
+ * "NAME.EXT" format, without the padding spaces. The 'dst' buffer must be at
+ * least 'ENTRY_NAME_SIZE' bytes long.
+ */
+void get_entry_name(const DirectoryEntry* entry, char* dst);
+
+/*
+ * Convert the specified FAT date and time fields (e.g. 'modified_date' and
+ * 'modified_time') into a UNIX timestamp. FAT timestamps don't store a time
+ * zone, so they are interpreted as UTC. See p. 25 of the specification.
+ */
+int64_t fat_timestamp_to_unix(uint16_t date, uint16_t time);
+
+/*
+ * Convert the specified UNIX timestamp into FAT date and time fields, the
+ * inverse of 'fat_timestamp_to_unix'. Timestamps outside of the range supported
+ * by FAT (years 1980 to 2107) are clamped.
+ */
+void unix_to_fat_timestamp(int64_t timestamp, uint16_t* date, uint16_t* time);
 
 /*
  * Search for a directory entry with the specified name, in the specified array.
+ * Only files and directories before the end of the directory are considered.
  */
 DirectoryEntry* search_entry(DirectoryEntry* arr,
                              size_t size,
@@ -148,9 +269,11 @@ DirectoryEntry* search_entry(DirectoryEntry* arr,
 
 /*
  * Read the contents of the specified file into the destination byte array.
+ * Returns false if a sector can't be read, or if the cluster chain is longer
+ * than the volume (i.e. it contains a cycle).
  */
 bool read_file(ByteArray* dst,
-               FILE* disk,
+               const Disk* disk,
                const ExtendedBPB* ebpb,
                ByteArray fat,
                const DirectoryEntry* file);
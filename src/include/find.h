@@ -0,0 +1,80 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FIND_H_
+#define FIND_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h> /* FILE */
+
+#include "disk.h"
+
+enum EFindType {
+    FIND_TYPE_ANY,
+    FIND_TYPE_FILE,
+    FIND_TYPE_DIRECTORY,
+};
+
+/*
+ * Predicates of a 'find' query. An entry is a hit if it satisfies all of them.
+ *
+ * The timestamps are stored in the same packed format used by the directory
+ * entries, with the date in the high 16 bits and the time in the low 16 bits,
+ * so they can be compared without decoding the entries.
+ */
+typedef struct {
+    const char* start_path; /* Only search below this directory */
+    char* name_glob;        /* Upper-case 'fnmatch' pattern, or NULL */
+    enum EFindType type;
+    uint8_t attributes; /* Attribute bits that must be set */
+    uint64_t min_size;  /* Included */
+    uint64_t max_size;  /* Included */
+    uint32_t after;     /* Modified at or after, included */
+    uint32_t before;    /* Modified before, excluded */
+} FindQuery;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Parse the arguments of the 'find' command into the specified query. The
+ * syntax is similar to the one of find(1):
+ *
+ *     [PATH] [-name GLOB] [-type f|d] [-size [+|-]N[k|M|G]]
+ *            [-after DATE] [-before DATE] [-attr RHSA]
+ *
+ * Dates have the format "YYYY-MM-DD" or "YYYY-MM-DDTHH:MM:SS", and like the
+ * FAT timestamps, their seconds are rounded down to even. Prints an error
+ * and returns false if the arguments are invalid. The query must be freed with
+ * 'find_free_query'.
+ */
+bool find_parse_query(FindQuery* query, int argc, char** argv);
+
+/*
+ * Free the members of a query returned by 'find_parse_query'.
+ */
+void find_free_query(FindQuery* query);
+
+/*
+ * Print a line to 'out' for each entry of the specified disk that matches the
+ * query, with its modification date, size and path. Only the metadata of the
+ * directories below the starting path is read.
+ */
+bool find_run(FILE* out, const Disk* disk, const FindQuery* query);
+
+#endif /* FIND_H_ */
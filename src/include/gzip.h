@@ -0,0 +1,50 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef GZIP_H_
+#define GZIP_H_ 1
+
+#include <stdbool.h>
+
+#include "disk.h"
+
+/*
+ * Number of uncompressed bytes between checkpoints in the index of a gzip
+ * image. Reading any byte of the image decompresses, at most, this many bytes.
+ */
+#define GZIP_SPAN (4 * 1024 * 1024)
+
+/*
+ * Return true if the specified file starts with the gzip magic number.
+ */
+bool is_gzip_file(int fd);
+
+/*
+ * Open the gzip-compressed image in 'disk->fd' for random access, and set the
+ * backend of 'disk' accordingly. The 'disk->size' member is set to the size of
+ * the uncompressed image.
+ *
+ * Random access is possible thanks to an index of checkpoints with the state of
+ * the decompressor every 'GZIP_SPAN' bytes. Building the index requires
+ * decompressing the whole image once, so it's cached next to the image (in
+ * 'path' with the '.gzidx' extension) and mapped into memory when it's still
+ * valid.
+ */
+bool gzip_disk_open(Disk* disk, const char* path);
+
+#endif /* GZIP_H_ */
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDEX_H_
+#define INDEX_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "util.h" /* STATIC_ASSERT */
+#include "disk.h"
+#include "fat12.h"
+
+/*
+ * Sidecar metadata index of a disk image, stored in a separate file (usually
+ * with the '.idx' extension). It contains the decoded FAT, the directory tree
+ * and a hash table for looking up paths, so later invocations can map it into
+ * memory instead of parsing the image again.
+ *
+ * The file starts with an 'IndexHeader', and the offsets of the other sections
+ * are relative to the start of the file. All values are stored in the byte
+ * order of the machine that built the index.
+ */
+#define INDEX_MAGIC   "DFATIDX"
+#define INDEX_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+
+    /* Used for detecting stale indexes */
+    uint64_t image_size;
+    int64_t image_mtime_sec;
+    int64_t image_mtime_nsec;
+    uint64_t fat_checksum;
+
+    /* Number of elements in each section */
+    uint32_t chain_count;
+    uint32_t entry_count;
+    uint32_t slot_count;
+    uint32_t strings_size;
+
+    /* Offsets of each section */
+    uint64_t chains_offset;
+    uint64_t entries_offset;
+    uint64_t slots_offset;
+    uint64_t strings_offset;
+} IndexHeader;
+STATIC_ASSERT(sizeof(IndexHeader) == 96);
+
+/*
+ * Entry in the directory tree of the index. The entries are stored in the same
+ * pre-order used by 'tree_walk', so the children of a directory always follow
+ * their parent.
+ */
+typedef struct {
+    uint32_t path_offset; /* Offset of the NULL-terminated path in 'strings' */
+    uint32_t parent;      /* Index of the parent entry, or 'INDEX_NO_PARENT' */
+    DirectoryEntry entry;
+} IndexEntry;
+STATIC_ASSERT(sizeof(IndexEntry) == 40);
+
+#define INDEX_NO_PARENT UINT32_MAX
+
+/*
+ * Index mapped into memory with 'index_open'.
+ */
+typedef struct {
+    void* map;
+    size_t map_size;
+
+    const IndexHeader* header;
+    const uint16_t* chains;     /* Decoded FAT, indexed by cluster number */
+    const IndexEntry* entries;  /* Directory tree */
+    const uint32_t* slots;      /* Hash table, entry index plus one */
+    const char* strings;        /* Paths of the entries */
+} Index;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Build the index of the specified disk image, and write it to 'index_path'.
+ *
+ * The index is written to a temporary file first, and then renamed, so an
+ * existing index is never left half-written.
+ */
+bool index_build(const char* index_path, const Disk* disk);
+
+/*
+ * Map the index in 'index_path' into memory. The index is only opened if the
+ * size and modification time of the disk image, and the checksum of its boot
+ * sector and FAT, match the ones stored in the index. The caller must call
+ * 'index_close' when done.
+ */
+bool index_open(Index* index, const char* index_path, const Disk* disk);
+
+/*
+ * Unmap the specified index.
+ */
+void index_close(Index* index);
+
+/*
+ * Return the entry with the specified absolute path (e.g. "/DIR1/B.TXT"), or
+ * NULL if it's not in the index. The lookup is case-insensitive.
+ */
+const IndexEntry* index_lookup(const Index* index, const char* path);
+
+/*
+ * Return the path of the specified entry.
+ */
+static inline const char* index_entry_path(const Index* index,
+                                           const IndexEntry* entry) {
+    return &index->strings[entry->path_offset];
+}
+
+#endif /* INDEX_H_ */
@@ -0,0 +1,44 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACK_H_
+#define PACK_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Build a FAT12 image in 'image_path' with the contents of the 'src_dir'
+ * directory of the host.
+ *
+ * The whole layout is planned before writing anything: every file and
+ * directory is stored in a single contiguous run of clusters, in the same
+ * order as a depth-first traversal of the tree, and the image is written
+ * sequentially from start to end.
+ *
+ * If 'image_size' is zero, the smallest image that fits the files is built.
+ * Otherwise, the image will have the specified size in bytes.
+ *
+ * The image only depends on the names, contents and timestamps of the files,
+ * so packing the same directory twice produces the same image.
+ */
+bool pack_directory(const char* src_dir,
+                    const char* image_path,
+                    uint64_t image_size);
+
+#endif /* PACK_H_ */
@@ -0,0 +1,110 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARTITION_H_
+#define PARTITION_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h> /* FILE */
+
+#include "disk.h"
+#include "fat12.h"
+
+/*
+ * Size of the sectors used for the LBA addresses of MBR and GPT partition
+ * tables.
+ */
+#define PARTITION_SECTOR_SIZE 512
+
+/*
+ * Type of partition table in a disk image. Disks without a partition table
+ * (e.g. floppy images) contain a single volume starting at offset zero.
+ */
+enum EPartitionTable {
+    PARTITION_TABLE_NONE,
+    PARTITION_TABLE_MBR,
+    PARTITION_TABLE_GPT,
+};
+
+/*
+ * Single partition in a partition table.
+ */
+typedef struct {
+    uint32_t number;    /* Starting at 1, logical MBR partitions start at 5 */
+    uint64_t start_lba; /* In 'PARTITION_SECTOR_SIZE' units */
+    uint64_t sector_count;
+
+    uint8_t mbr_type;      /* Only used in MBR partitions */
+    uint8_t gpt_type[16];  /* Only used in GPT partitions */
+    enum EFatType fat_type; /* Detected from the boot sector */
+} Partition;
+
+typedef struct {
+    enum EPartitionTable type;
+    Partition* arr;
+    size_t size;
+} PartitionTable;
+
+/*
+ * Function called by 'partitions_run_parallel' for each FAT12 partition, with
+ * the output file of that partition.
+ */
+typedef bool (*PartitionWorker)(FILE* out, const Disk* volume, void* ctx);
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Read the MBR (including extended partitions) or GPT partition table of the
+ * specified disk. If the disk has no partition table, 'dst->type' is set to
+ * 'PARTITION_TABLE_NONE' and the table is empty. The caller must call
+ * 'free_partition_table' when done.
+ */
+bool read_partition_table(PartitionTable* dst, const Disk* disk);
+
+/*
+ * Free the partitions of the specified table.
+ */
+void free_partition_table(PartitionTable* table);
+
+/*
+ * Return the region of the disk used by the specified partition.
+ */
+Disk get_partition_volume(const Disk* disk, const Partition* partition);
+
+/*
+ * Store in 'dst' the first FAT12 volume of the specified disk: either the
+ * first FAT12 partition, or the whole disk if it has no partition table.
+ */
+bool get_first_volume(Disk* dst, const Disk* disk);
+
+/*
+ * Call the specified worker for every FAT12 partition in the table, each one
+ * in its own thread. The output of each worker is buffered, and written to
+ * 'out' in the order of the partition table once all of them finished.
+ *
+ * Returns false if any of the workers failed.
+ */
+bool partitions_run_parallel(FILE* out,
+                             const Disk* disk,
+                             const PartitionTable* table,
+                             PartitionWorker worker,
+                             void* ctx);
+
+#endif /* PARTITION_H_ */
@@ -19,9 +19,12 @@
 #ifndef PRINT_H_
 #define PRINT_H_ 1
 
+#include <stdint.h>
+#include <stddef.h>
 #include <stdio.h> /* FILE */
 
 #include "fat12.h"
+#include "partition.h"
 
 /*
  * Print the data in the specified Extended Bios Parameter Block (EBPB) to the
@@ -31,8 +34,23 @@ void print_ebpb(FILE* fp, const ExtendedBPB* ebpb);
 
 /*
  * Print an array of directory entries of the specified size to the specified
- * file.
+ * file, up to the end-of-directory marker.
  */
 void print_directory_entries(FILE* fp, const DirectoryEntry* arr, size_t size);
 
+/*
+ * Print the cluster chain that starts at 'first_cluster' to the specified file,
+ * grouping contiguous clusters into ranges (e.g. "2-5, 9, 12-13"). The 'chains'
+ * array contains the decoded FAT, with 'chain_count' entries.
+ */
+void print_cluster_chain(FILE* fp,
+                         const uint16_t* chains,
+                         size_t chain_count,
+                         uint16_t first_cluster);
+
+/*
+ * Print the partitions of the specified partition table to the specified file.
+ */
+void print_partition_table(FILE* fp, const PartitionTable* table);
+
 #endif /* PRINT_H_ */
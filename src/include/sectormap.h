@@ -0,0 +1,93 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SECTORMAP_H_
+#define SECTORMAP_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "disk.h"
+
+/*
+ * Size of the sectors used by the LBAs of the map, in bytes. It's the unit used
+ * by partition tables and tools like 'badblocks' or 'blkparse', regardless of
+ * the sector size of the volume.
+ */
+#define SECTORMAP_SECTOR_SIZE 512
+
+/*
+ * Range of consecutive sectors that belong to the same file, directory or
+ * region of the volume.
+ */
+typedef struct {
+    uint64_t start_lba;    /* 512-byte sectors, from the start of the image */
+    uint64_t sector_count;
+    uint64_t offset;       /* Offset of the first sector inside its owner */
+    size_t owner_offset;   /* Name of the owner, inside 'SectorMap.strings' */
+} SectorExtent;
+
+/*
+ * Reverse map from the sectors of a volume to their owners, sorted by LBA. The
+ * owners are absolute paths (e.g. "/DIR1/B.TXT" or "/DIR1/" for directories),
+ * or names between angle brackets for the other regions (e.g. "<FAT 1>",
+ * "<root directory>" or "<free>"). For the clusters that don't belong to any
+ * file, the offset is relative to the start of the data region.
+ */
+typedef struct {
+    SectorExtent* extents;
+    size_t extent_count;
+    size_t extent_capacity;
+
+    char* strings;
+    size_t strings_size;
+    size_t strings_capacity;
+} SectorMap;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Build the reverse map of the specified volume, from the cluster chains of
+ * every file and directory. The LBAs are in 512-byte sectors (see
+ * 'SECTORMAP_SECTOR_SIZE'), relative to the start of the image, so partitions
+ * and volumes with bigger sectors are handled transparently. The map must be
+ * freed with 'sectormap_free'.
+ */
+bool sectormap_build(SectorMap* map, const Disk* disk);
+
+/*
+ * Free the arrays of the specified map.
+ */
+void sectormap_free(SectorMap* map);
+
+/*
+ * Return the extent that contains the specified LBA, with a binary search, or
+ * NULL if the sector is not part of the volume.
+ */
+const SectorExtent* sectormap_lookup(const SectorMap* map, uint64_t lba);
+
+/*
+ * Return the name of the owner of the specified extent.
+ */
+static inline const char* sectormap_owner(const SectorMap* map,
+                                          const SectorExtent* extent) {
+    return &map->strings[extent->owner_offset];
+}
+
+#endif /* SECTORMAP_H_ */
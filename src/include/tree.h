@@ -0,0 +1,75 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TREE_H_
+#define TREE_H_ 1
+
+#include <stdbool.h>
+
+#include "bytearray.h"
+#include "disk.h"
+#include "fat12.h"
+
+/*
+ * Maximum length of the paths built by 'tree_walk', including the NULL
+ * terminator, and maximum number of nested directories that can be traversed.
+ */
+#define TREE_PATH_MAX  512
+#define TREE_DEPTH_MAX 32
+
+/*
+ * Function called by 'tree_walk' for each entry in the directory tree. The
+ * 'path' argument is the absolute path of the entry (e.g. "/DIR1/B.TXT"). If
+ * the function returns false, the walk is stopped.
+ */
+typedef bool (*TreeVisitor)(void* ctx,
+                            const char* path,
+                            const DirectoryEntry* entry);
+
+/*
+ * Call the specified visitor for every file and directory in the specified
+ * disk, in pre-order, starting from the root directory. The '.' and '..'
+ * entries, Long File Name (LFN) entries, volume labels and deleted entries are
+ * ignored.
+ *
+ * Returns false if a directory could not be read, if a directory is nested
+ * deeper than 'TREE_DEPTH_MAX', or if the visitor stopped the walk.
+ */
+bool tree_walk(const Disk* disk,
+               const ExtendedBPB* ebpb,
+               ByteArray fat,
+               TreeVisitor visitor,
+               void* ctx);
+
+/*
+ * Same as 'tree_walk', but only visit the entries below the directory in
+ * 'start_path' (e.g. "/DIR1/SUB"), which isn't visited itself. The components
+ * of the path are case-insensitive 8.3 names. The rest of the tree is not read
+ * at all.
+ *
+ * Returns false if the directory doesn't exist, or for the same reasons as
+ * 'tree_walk'.
+ */
+bool tree_walk_at(const Disk* disk,
+                  const ExtendedBPB* ebpb,
+                  ByteArray fat,
+                  const char* start_path,
+                  TreeVisitor visitor,
+                  void* ctx);
+
+#endif /* TREE_H_ */
@@ -21,6 +21,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 /*
@@ -50,8 +51,14 @@
 /*----------------------------------------------------------------------------*/
 
 /*
- * Return true if the bytes in the specified memory region are all zero.
+ * Initial value for 'hash_fnv1a'.
  */
-bool is_mem_zero(const void* ptr, size_t size);
+#define FNV1A_INIT 0xCBF29CE484222325ULL
+
+/*
+ * Update the specified 64-bit FNV-1a hash with the specified bytes, and return
+ * the new hash. The first call should receive 'FNV1A_INIT' as the 'hash'.
+ */
+uint64_t hash_fnv1a(uint64_t hash, const void* ptr, size_t size);
 
 #endif /* UTIL_H_ */
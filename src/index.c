@@ -0,0 +1,447 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Needed for 'fstat' and 'mmap' */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h> /* rename, remove */
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "include/bytearray.h"
+#include "include/disk.h"
+#include "include/fat12.h"
+#include "include/tree.h"
+#include "include/util.h"
+#include "include/index.h"
+
+/*
+ * Alignment of each section in the index file.
+ */
+#define SECTION_ALIGNMENT 8
+
+/*
+ * Index being built by 'index_build'.
+ */
+typedef struct {
+    IndexEntry* entries;
+    size_t entry_count;
+    size_t entry_capacity;
+
+    char* strings;
+    size_t strings_size;
+    size_t strings_capacity;
+
+    /* Index of the last directory visited at each depth */
+    uint32_t parents[TREE_DEPTH_MAX + 1];
+} IndexBuilder;
+
+/*----------------------------------------------------------------------------*/
+/* Helper functions */
+
+static inline uint64_t align_offset(uint64_t offset) {
+    const uint64_t mask = SECTION_ALIGNMENT - 1;
+    return (offset + mask) & ~mask;
+}
+
+/*
+ * Hash the specified path for the index hash table, ignoring the case of the
+ * characters.
+ */
+static uint64_t hash_path(const char* path) {
+    uint64_t hash = FNV1A_INIT;
+    for (; *path != '\0'; path++) {
+        const char c = (char)toupper((unsigned char)*path);
+        hash         = hash_fnv1a(hash, &c, 1);
+    }
+    return hash;
+}
+
+/*
+ * Read the boot sector and the FAT of the specified disk, and calculate their
+ * checksum. On success, the caller is responsible for freeing the returned
+ * boot sector and the FAT data.
+ */
+static bool read_volume_info(const Disk* disk,
+                             BootSector** boot_sector,
+                             ByteArray* fat,
+                             uint64_t* checksum) {
+    *boot_sector = read_boot_sector(disk);
+    if (*boot_sector == NULL)
+        return false;
+
+    if (!read_fat(fat, disk, &(*boot_sector)->ebpb)) {
+        free(*boot_sector);
+        return false;
+    }
+
+    *checksum = hash_fnv1a(FNV1A_INIT, *boot_sector, sizeof(BootSector));
+    *checksum = hash_fnv1a(*checksum, fat->data, fat->size);
+    return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Building the index */
+
+static bool builder_visit(void* ctx,
+                          const char* path,
+                          const DirectoryEntry* entry) {
+    IndexBuilder* builder = ctx;
+
+    if (builder->entry_count >= builder->entry_capacity) {
+        const size_t new_capacity = (builder->entry_capacity == 0)
+                                      ? 64
+                                      : builder->entry_capacity * 2;
+        IndexEntry* new_entries =
+          realloc(builder->entries, new_capacity * sizeof(IndexEntry));
+        if (new_entries == NULL)
+            return false;
+        builder->entries        = new_entries;
+        builder->entry_capacity = new_capacity;
+    }
+
+    const size_t path_size = strlen(path) + 1;
+    if (builder->strings_size + path_size > builder->strings_capacity) {
+        size_t new_capacity = (builder->strings_capacity == 0)
+                                ? 1024
+                                : builder->strings_capacity * 2;
+        while (new_capacity < builder->strings_size + path_size)
+            new_capacity *= 2;
+        char* new_strings = realloc(builder->strings, new_capacity);
+        if (new_strings == NULL)
+            return false;
+        builder->strings          = new_strings;
+        builder->strings_capacity = new_capacity;
+    }
+
+    /* The depth of the entry is the number of slashes in its path */
+    size_t depth = 0;
+    for (const char* p = path; *p != '\0'; p++)
+        if (*p == '/')
+            depth++;
+    if (depth == 0 || depth > TREE_DEPTH_MAX + 1)
+        return false;
+
+    const uint32_t idx = (uint32_t)builder->entry_count++;
+    IndexEntry* dst    = &builder->entries[idx];
+    dst->path_offset   = (uint32_t)builder->strings_size;
+    dst->parent = (depth == 1) ? INDEX_NO_PARENT : builder->parents[depth - 2];
+    dst->entry  = *entry;
+
+    memcpy(&builder->strings[builder->strings_size], path, path_size);
+    builder->strings_size += path_size;
+
+    if ((entry->attributes & ATTR_DIRECTORY) && depth <= TREE_DEPTH_MAX)
+        builder->parents[depth - 1] = idx;
+
+    return true;
+}
+
+/*
+ * Write 'size' bytes at the specified offset of the file, padding the file
+ * with zeros up to that offset.
+ */
+static bool write_section(FILE* fp,
+                          uint64_t offset,
+                          const void* data,
+                          size_t size) {
+    static const char padding[SECTION_ALIGNMENT] = { 0 };
+
+    const long current = ftell(fp);
+    if (current < 0 || (uint64_t)current > offset ||
+        offset - current > sizeof(padding))
+        return false;
+
+    if (fwrite(padding, 1, offset - current, fp) != offset - current)
+        return false;
+
+    return size == 0 || fwrite(data, size, 1, fp) == 1;
+}
+
+bool index_build(const char* index_path, const Disk* disk) {
+    struct stat st;
+    if (fstat(disk->fd, &st) != 0)
+        return false;
+
+    BootSector* boot_sector;
+    ByteArray fat;
+    uint64_t checksum;
+    if (!read_volume_info(disk, &boot_sector, &fat, &checksum))
+        return false;
+
+    const ExtendedBPB* ebpb = &boot_sector->ebpb;
+    bool success            = false;
+    uint16_t* chains        = NULL;
+    uint32_t* slots         = NULL;
+    char* tmp_path          = NULL;
+    IndexBuilder builder    = { 0 };
+
+    /* Decode the whole FAT, including the two reserved entries */
+    const size_t chain_count = get_cluster_count(ebpb) + 2;
+    chains                   = malloc(chain_count * sizeof(uint16_t));
+    if (chains == NULL)
+        goto done;
+    for (size_t i = 0; i < chain_count; i++)
+        chains[i] = fat12_get_linked_cluster(fat, (uint16_t)i);
+
+    if (!tree_walk(disk, ebpb, fat, builder_visit, &builder))
+        goto done;
+
+    /* Build the hash table, keeping the load factor under 0.5 */
+    size_t slot_count = 16;
+    while (slot_count < builder.entry_count * 2)
+        slot_count *= 2;
+    slots = calloc(slot_count, sizeof(uint32_t));
+    if (slots == NULL)
+        goto done;
+    for (size_t i = 0; i < builder.entry_count; i++) {
+        const char* path = &builder.strings[builder.entries[i].path_offset];
+        size_t slot      = hash_path(path) & (slot_count - 1);
+        while (slots[slot] != 0)
+            slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = (uint32_t)(i + 1);
+    }
+
+    IndexHeader header = { 0 };
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version          = INDEX_VERSION;
+    header.header_size      = sizeof(IndexHeader);
+    header.image_size       = (uint64_t)st.st_size;
+    header.image_mtime_sec  = (int64_t)st.st_mtim.tv_sec;
+    header.image_mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+    header.fat_checksum     = checksum;
+    header.chain_count      = (uint32_t)chain_count;
+    header.entry_count      = (uint32_t)builder.entry_count;
+    header.slot_count       = (uint32_t)slot_count;
+    header.strings_size     = (uint32_t)builder.strings_size;
+    header.chains_offset    = align_offset(sizeof(IndexHeader));
+    header.entries_offset =
+      align_offset(header.chains_offset + chain_count * sizeof(uint16_t));
+    header.slots_offset = align_offset(
+      header.entries_offset + builder.entry_count * sizeof(IndexEntry));
+    header.strings_offset =
+      align_offset(header.slots_offset + slot_count * sizeof(uint32_t));
+
+    /* Write everything to a temporary file, and rename it when done */
+    const size_t index_path_len = strlen(index_path);
+    tmp_path                    = malloc(index_path_len + STRLEN(".tmp") + 1);
+    if (tmp_path == NULL)
+        goto done;
+    memcpy(tmp_path, index_path, index_path_len);
+    memcpy(&tmp_path[index_path_len], ".tmp", STRLEN(".tmp") + 1);
+
+    FILE* fp = fopen(tmp_path, "wb");
+    if (fp == NULL)
+        goto done;
+
+    success =
+      write_section(fp, 0, &header, sizeof(header)) &&
+      write_section(fp,
+                    header.chains_offset,
+                    chains,
+                    chain_count * sizeof(uint16_t)) &&
+      write_section(fp,
+                    header.entries_offset,
+                    builder.entries,
+                    builder.entry_count * sizeof(IndexEntry)) &&
+      write_section(fp,
+                    header.slots_offset,
+                    slots,
+                    slot_count * sizeof(uint32_t)) &&
+      write_section(fp,
+                    header.strings_offset,
+                    builder.strings,
+                    builder.strings_size);
+
+    if (fclose(fp) != 0)
+        success = false;
+
+    if (success)
+        success = (rename(tmp_path, index_path) == 0);
+    else
+        remove(tmp_path);
+
+done:
+    free(tmp_path);
+    free(slots);
+    free(builder.strings);
+    free(builder.entries);
+    free(chains);
+    free(fat.data);
+    free(boot_sector);
+    return success;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Reading the index */
+
+/*
+ * Return true if the section at the specified offset, with the specified size,
+ * is inside the mapped index.
+ */
+static inline bool is_valid_section(const Index* index,
+                                    uint64_t offset,
+                                    uint64_t count,
+                                    size_t item_size) {
+    return offset % SECTION_ALIGNMENT == 0 && offset <= index->map_size &&
+           count <= (index->map_size - offset) / item_size;
+}
+
+/*
+ * Check that the header of the mapped index is valid, and that it matches the
+ * specified disk image.
+ */
+static bool is_valid_index(const Index* index, const Disk* disk) {
+    const IndexHeader* header = index->header;
+    if (index->map_size < sizeof(IndexHeader) ||
+        memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+        header->version != INDEX_VERSION ||
+        header->header_size != sizeof(IndexHeader))
+        return false;
+
+    if (!is_valid_section(index,
+                          header->chains_offset,
+                          header->chain_count,
+                          sizeof(uint16_t)) ||
+        !is_valid_section(index,
+                          header->entries_offset,
+                          header->entry_count,
+                          sizeof(IndexEntry)) ||
+        !is_valid_section(index,
+                          header->slots_offset,
+                          header->slot_count,
+                          sizeof(uint32_t)) ||
+        !is_valid_section(index,
+                          header->strings_offset,
+                          header->strings_size,
+                          sizeof(char)))
+        return false;
+
+    /* The paths must be NULL-terminated */
+    const char* strings = (const char*)index->map + header->strings_offset;
+    if (header->strings_size > 0 &&
+        strings[header->strings_size - 1] != '\0')
+        return false;
+
+    /* The hash table size must be a power of two, with some free slots */
+    if (header->slot_count == 0 ||
+        (header->slot_count & (header->slot_count - 1)) != 0 ||
+        header->slot_count <= header->entry_count)
+        return false;
+
+    /*
+     * Every entry must point inside the strings, and its parent must come
+     * before it, since the entries are stored in pre-order.
+     */
+    const IndexEntry* entries =
+      (const IndexEntry*)((const char*)index->map + header->entries_offset);
+    for (uint32_t i = 0; i < header->entry_count; i++)
+        if (entries[i].path_offset >= header->strings_size ||
+            (entries[i].parent != INDEX_NO_PARENT && entries[i].parent >= i))
+            return false;
+
+    /* Cheap checks first, the checksum requires reading the FAT */
+    struct stat st;
+    if (fstat(disk->fd, &st) != 0 ||
+        header->image_size != (uint64_t)st.st_size ||
+        header->image_mtime_sec != (int64_t)st.st_mtim.tv_sec ||
+        header->image_mtime_nsec != (int64_t)st.st_mtim.tv_nsec)
+        return false;
+
+    BootSector* boot_sector;
+    ByteArray fat;
+    uint64_t checksum;
+    if (!read_volume_info(disk, &boot_sector, &fat, &checksum))
+        return false;
+    free(fat.data);
+    free(boot_sector);
+
+    return checksum == header->fat_checksum;
+}
+
+bool index_open(Index* index, const char* index_path, const Disk* disk) {
+    const int fd = open(index_path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    index->map_size = (size_t)st.st_size;
+    index->map = mmap(NULL, index->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED)
+        return false;
+
+    const char* base = index->map;
+    index->header    = index->map;
+    if (!is_valid_index(index, disk)) {
+        munmap(index->map, index->map_size);
+        return false;
+    }
+
+    index->chains  = (const uint16_t*)(base + index->header->chains_offset);
+    index->entries = (const IndexEntry*)(base + index->header->entries_offset);
+    index->slots   = (const uint32_t*)(base + index->header->slots_offset);
+    index->strings = base + index->header->strings_offset;
+    return true;
+}
+
+void index_close(Index* index) {
+    munmap(index->map, index->map_size);
+}
+
+const IndexEntry* index_lookup(const Index* index, const char* path) {
+    const size_t mask = index->header->slot_count - 1;
+    size_t slot       = hash_path(path) & mask;
+
+    for (size_t i = 0; i <= mask && index->slots[slot] != 0; i++) {
+        const uint32_t idx = index->slots[slot] - 1;
+        if (idx < index->header->entry_count &&
+            index->entries[idx].path_offset < index->header->strings_size) {
+            const IndexEntry* entry = &index->entries[idx];
+            const char* entry_path  = index_entry_path(index, entry);
+
+            /* Compare the paths, ignoring the case */
+            const char* a = entry_path;
+            const char* b = path;
+            while (*a != '\0' &&
+                   toupper((unsigned char)*a) == toupper((unsigned char)*b)) {
+                a++;
+                b++;
+            }
+            if (*a == '\0' && *b == '\0')
+                return entry;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return NULL;
+}
@@ -16,73 +16,167 @@
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+/* Needed for 'isatty' */
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
 #include <errno.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "include/bytearray.h"
+#include "include/disk.h"
 #include "include/fat12.h"
+#include "include/partition.h"
 #include "include/print.h"
+#include "include/diff.h"
+#include "include/index.h"
+#include "include/export.h"
+#include "include/pack.h"
+#include "include/defrag.h"
+#include "include/find.h"
+#include "include/sectormap.h"
 
-int main(int argc, char** argv) {
-    int exit_code = 0;
+/*
+ * Sub-command of the program, selected with the first argument. The 'argv'
+ * array received by the function starts with the name of the command.
+ */
+typedef struct {
+    const char* name;
+    int (*func)(const char* self, int argc, char** argv);
+} Command;
 
-    if (argc < 2 || argc > 3) {
-        ERR("Usage: %s DISK.img [FILENAME]\n", argv[0]);
-        return 1;
+/*
+ * Arguments of 'dump_worker', shared by all partitions.
+ */
+typedef struct {
+    const char* diskimg_path;
+    const char* filename;
+} DumpArgs;
+
+/*
+ * Flags for 'disk_open', set from the global options.
+ */
+static unsigned disk_flags = 0;
+
+static void print_usage(const char* self) {
+    ERR("Usage: %s DISK.img [FILENAME]\n"
+        "       %s diff A.img B.img\n"
+        "       %s index DISK.img [PATH...]\n"
+        "       %s export --tar DISK.img\n"
+        "       %s pack SRC_DIR DISK.img [SIZE_KIB]\n"
+        "       %s defrag [--dry-run] DISK.img\n"
+        "       %s find DISK.img [PATH] [PREDICATE...]\n"
+        "       %s lba DISK.img [LBA...]\n"
+        "\n"
+        "The '--direct' option can be specified before any of them for\n"
+        "reading the images without using the page cache.",
+        self,
+        self,
+        self,
+        self,
+        self,
+        self,
+        self,
+        self);
+}
+
+/*
+ * Open the disk image in the specified path, and store in 'volume' its first
+ * FAT12 volume. See 'get_first_volume'.
+ */
+static bool open_volume(Disk* disk, Disk* volume, const char* path) {
+    if (!disk_open(disk, path, disk_flags)) {
+        ERR("Error opening '%s': %s", path, strerror(errno));
+        return false;
     }
 
-    const char* diskimg_path = argv[1];
-    FILE* diskimg_fp         = fopen(diskimg_path, "rb");
-    if (diskimg_fp == NULL) {
-        ERR("Error opening '%s': %s", diskimg_path, strerror(errno));
-        return 1;
+    if (!get_first_volume(volume, disk)) {
+        ERR("Could not find a FAT12 volume in '%s'.", path);
+        disk_close(disk);
+        return false;
     }
 
-    BootSector* boot_sector = read_boot_sector(diskimg_fp);
+    return true;
+}
+
+/*
+ * Open the specified disk image and read its partition table. If it has no
+ * partition table, the whole disk is a single volume.
+ */
+static bool open_partitions(Disk* disk,
+                            PartitionTable* table,
+                            const char* path) {
+    if (!disk_open(disk, path, disk_flags)) {
+        ERR("Error opening '%s': %s", path, strerror(errno));
+        return false;
+    }
+
+    if (!read_partition_table(table, disk)) {
+        ERR("Could not read partition table of '%s'.", path);
+        disk_close(disk);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Print the EBPB, the FAT and the root directory of the specified volume. If
+ * 'filename' is not NULL, the contents of that file in the root directory are
+ * also printed.
+ */
+static bool dump_volume(FILE* out,
+                        const Disk* disk,
+                        const char* diskimg_path,
+                        const char* filename) {
+    bool success = true;
+
+    BootSector* boot_sector = read_boot_sector(disk);
     if (boot_sector == NULL) {
         ERR("Could not read boot sector of '%s'.", diskimg_path);
-        exit_code = 1;
+        success = false;
         goto invalid_boot_sector;
     }
 
-    puts("Extended Bios Parameter Block (EBPB):");
-    print_ebpb(stdout, &boot_sector->ebpb);
+    fprintf(out, "Extended Bios Parameter Block (EBPB):\n");
+    print_ebpb(out, &boot_sector->ebpb);
 
     ByteArray fat;
-    if (!read_fat(&fat, diskimg_fp, &boot_sector->ebpb)) {
+    if (!read_fat(&fat, disk, &boot_sector->ebpb)) {
         ERR("Could not read FAT of '%s'.", diskimg_path);
-        exit_code = 1;
+        success = false;
         goto invalid_fat;
     }
 
-    putchar('\n');
-    puts("File Allocation Table (FAT):");
-    bytearray_print(stdout, fat);
+    fputc('\n', out);
+    fprintf(out, "File Allocation Table (FAT):\n");
+    bytearray_print(out, fat);
 
     DirectoryEntry* root_directory =
-      read_root_directory(diskimg_fp, &boot_sector->ebpb);
+      read_root_directory(disk, &boot_sector->ebpb);
     if (root_directory == NULL) {
         ERR("Could not read root directory of '%s'.", diskimg_path);
-        exit_code = 1;
+        success = false;
         goto invalid_root_directory;
     }
 
-    putchar('\n');
-    puts("Root directory:");
-    print_directory_entries(stdout,
+    fputc('\n', out);
+    fprintf(out, "Root directory:\n");
+    print_directory_entries(out,
                             root_directory,
                             boot_sector->ebpb.dir_entries_count);
 
-    if (argc >= 3) {
-        const char* filename = argv[2];
+    if (filename != NULL) {
         if (strlen(filename) != 11) {
             ERR("Invalid filename, expected 11 characters, got '%s'.",
                 filename);
-            exit_code = 1;
+            success = false;
             goto invalid_file;
         }
 
@@ -91,19 +185,15 @@ int main(int argc, char** argv) {
                                             filename);
         if (file == NULL) {
             ERR("File '%s' is not present in the root directory.", filename);
-            exit_code = 1;
+            success = false;
             goto invalid_file;
         }
 
         ByteArray file_contents;
-        if (read_file(&file_contents,
-                      diskimg_fp,
-                      &boot_sector->ebpb,
-                      fat,
-                      file)) {
-            putchar('\n');
-            printf("Contents of '%s':\n", filename);
-            bytearray_print(stdout, file_contents);
+        if (read_file(&file_contents, disk, &boot_sector->ebpb, fat, file)) {
+            fputc('\n', out);
+            fprintf(out, "Contents of '%s':\n", filename);
+            bytearray_print(out, file_contents);
             free(file_contents.data);
         } else {
             ERR("Could not read root directory of '%s'.", diskimg_path);
@@ -117,7 +207,383 @@ invalid_root_directory:
 invalid_fat:
     free(boot_sector);
 invalid_boot_sector:
-    fclose(diskimg_fp);
+    return success;
+}
+
+static bool dump_worker(FILE* out, const Disk* volume, void* ctx) {
+    const DumpArgs* args = ctx;
+    return dump_volume(out, volume, args->diskimg_path, args->filename);
+}
+
+static int cmd_dump(const char* self, int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        print_usage(self);
+        return 1;
+    }
+
+    const DumpArgs args = {
+        .diskimg_path = argv[1],
+        .filename     = (argc >= 3) ? argv[2] : NULL,
+    };
+
+    Disk disk;
+    PartitionTable table;
+    if (!open_partitions(&disk, &table, args.diskimg_path))
+        return 1;
+
+    /*
+     * Whole-disk images are dumped one partition per thread. Images without a
+     * partition table contain a single volume.
+     */
+    bool success;
+    if (table.type == PARTITION_TABLE_NONE) {
+        success = dump_volume(stdout, &disk, args.diskimg_path, args.filename);
+    } else {
+        print_partition_table(stdout, &table);
+        putchar('\n');
+        success = partitions_run_parallel(stdout, &disk, &table, dump_worker,
+                                          (void*)&args);
+    }
+
+    free_partition_table(&table);
+    disk_close(&disk);
+    return success ? 0 : 1;
+}
+
+static int cmd_diff(const char* self, int argc, char** argv) {
+    if (argc != 3) {
+        ERR("Usage: %s diff A.img B.img", self);
+        return 1;
+    }
+
+    Disk disk_a, volume_a;
+    if (!open_volume(&disk_a, &volume_a, argv[1]))
+        return 1;
+
+    Disk disk_b, volume_b;
+    if (!open_volume(&disk_b, &volume_b, argv[2])) {
+        disk_close(&disk_a);
+        return 1;
+    }
+
+    int exit_code = 0;
+    if (!diff_images(stdout, &volume_a, &volume_b)) {
+        ERR("Could not compare '%s' and '%s'.", argv[1], argv[2]);
+        exit_code = 1;
+    }
+
+    disk_close(&disk_b);
+    disk_close(&disk_a);
+    return exit_code;
+}
+
+static int cmd_index(const char* self, int argc, char** argv) {
+    if (argc < 2) {
+        ERR("Usage: %s index DISK.img [PATH...]", self);
+        return 1;
+    }
+
+    const char* diskimg_path = argv[1];
+    Disk disk, volume;
+    if (!open_volume(&disk, &volume, diskimg_path))
+        return 1;
+
+    /* The index is stored next to the image, with the '.idx' extension */
+    const size_t diskimg_path_len = strlen(diskimg_path);
+    char* index_path = malloc(diskimg_path_len + STRLEN(".idx") + 1);
+    if (index_path == NULL) {
+        disk_close(&disk);
+        return 1;
+    }
+    memcpy(index_path, diskimg_path, diskimg_path_len);
+    memcpy(&index_path[diskimg_path_len], ".idx", STRLEN(".idx") + 1);
+
+    /* If the index is missing or outdated, build it again */
+    Index index;
+    if (!index_open(&index, index_path, &volume) &&
+        (!index_build(index_path, &volume) ||
+         !index_open(&index, index_path, &volume))) {
+        ERR("Could not build index '%s' for '%s'.", index_path, diskimg_path);
+        free(index_path);
+        disk_close(&disk);
+        return 1;
+    }
+
+    int exit_code = 0;
+    if (argc == 2) {
+        for (uint32_t i = 0; i < index.header->entry_count; i++) {
+            const IndexEntry* entry = &index.entries[i];
+            const bool is_dir =
+              (entry->entry.attributes & ATTR_DIRECTORY) != 0;
+            printf("%s%s\n", index_entry_path(&index, entry),
+                   is_dir ? "/" : "");
+        }
+    }
+
+    for (int i = 2; i < argc; i++) {
+        const IndexEntry* entry = index_lookup(&index, argv[i]);
+        if (entry == NULL) {
+            ERR("File '%s' is not present in '%s'.", argv[i], diskimg_path);
+            exit_code = 1;
+            continue;
+        }
+
+        printf("%s:\n", index_entry_path(&index, entry));
+        print_directory_entries(stdout, &entry->entry, 1);
+        printf("Clusters: ");
+        print_cluster_chain(stdout,
+                            index.chains,
+                            index.header->chain_count,
+                            entry->entry.first_cluster_low);
+    }
+
+    index_close(&index);
+    free(index_path);
+    disk_close(&disk);
+    return exit_code;
+}
+
+/*
+ * Export every FAT12 partition in the table into its own directory of the same
+ * archive. A tar stream is serial, so the partitions are written one after
+ * another, straight to the output.
+ */
+static bool export_partitions(int out_fd,
+                              const Disk* disk,
+                              const PartitionTable* table) {
+    for (size_t i = 0; i < table->size; i++) {
+        const Partition* partition = &table->arr[i];
+        if (partition->fat_type != FAT_TYPE_12)
+            continue;
+
+        char prefix[32];
+        snprintf(prefix, sizeof(prefix), "partition%" PRIu32 "/",
+                 partition->number);
+
+        const Disk volume = get_partition_volume(disk, partition);
+        if (!export_tar_entries(out_fd, &volume, prefix))
+            return false;
+    }
+
+    return export_tar_end(out_fd);
+}
+
+static int cmd_export(const char* self, int argc, char** argv) {
+    if (argc != 3 || strcmp(argv[1], "--tar") != 0) {
+        ERR("Usage: %s export --tar DISK.img", self);
+        return 1;
+    }
 
+    if (isatty(STDOUT_FILENO)) {
+        ERR("Refusing to write a tar archive to a terminal.");
+        return 1;
+    }
+
+    const char* diskimg_path = argv[2];
+    Disk disk;
+    PartitionTable table;
+    if (!open_partitions(&disk, &table, diskimg_path))
+        return 1;
+
+    const bool success = (table.type == PARTITION_TABLE_NONE)
+                           ? export_tar(STDOUT_FILENO, &disk)
+                           : export_partitions(STDOUT_FILENO, &disk, &table);
+
+    if (!success)
+        ERR("Could not export '%s'.", diskimg_path);
+
+    free_partition_table(&table);
+    disk_close(&disk);
+    return success ? 0 : 1;
+}
+
+static int cmd_pack(const char* self, int argc, char** argv) {
+    if (argc != 3 && argc != 4) {
+        ERR("Usage: %s pack SRC_DIR DISK.img [SIZE_KIB]", self);
+        return 1;
+    }
+
+    uint64_t image_size = 0;
+    if (argc == 4) {
+        char* endptr;
+        errno                   = 0;
+        const unsigned long kib = strtoul(argv[3], &endptr, 10);
+        if (errno != 0 || *endptr != '\0' || kib == 0) {
+            ERR("Invalid image size: '%s'", argv[3]);
+            return 1;
+        }
+        image_size = (uint64_t)kib * 1024;
+    }
+
+    const char* src_dir      = argv[1];
+    const char* diskimg_path = argv[2];
+    if (!pack_directory(src_dir, diskimg_path, image_size)) {
+        ERR("Could not pack '%s' into '%s'.", src_dir, diskimg_path);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int cmd_defrag(const char* self, int argc, char** argv) {
+    const bool dry_run = (argc == 3 && strcmp(argv[1], "--dry-run") == 0);
+    if (argc != 2 && !dry_run) {
+        ERR("Usage: %s defrag [--dry-run] DISK.img", self);
+        return 1;
+    }
+
+    const char* diskimg_path = argv[argc - 1];
+    Disk disk, volume;
+    if (!open_volume(&disk, &volume, diskimg_path))
+        return 1;
+
+    int exit_code = 0;
+    if (!defrag_image(stdout, diskimg_path, &volume, dry_run)) {
+        ERR("Could not defragment '%s'.", diskimg_path);
+        exit_code = 1;
+    }
+
+    disk_close(&disk);
     return exit_code;
 }
+
+static bool find_worker(FILE* out, const Disk* volume, void* ctx) {
+    const FindQuery* query = ctx;
+    return find_run(out, volume, query);
+}
+
+static int cmd_find(const char* self, int argc, char** argv) {
+    if (argc < 2) {
+        ERR("Usage: %s find DISK.img [PATH] [-name GLOB] [-type f|d]\n"
+            "           [-size [+|-]N[k|M|G]] [-after DATE] [-before DATE]\n"
+            "           [-attr RHSA]",
+            self);
+        return 1;
+    }
+
+    FindQuery query;
+    if (!find_parse_query(&query, argc - 2, argv + 2))
+        return 1;
+
+    const char* diskimg_path = argv[1];
+    Disk disk;
+    PartitionTable table;
+    if (!open_partitions(&disk, &table, diskimg_path)) {
+        find_free_query(&query);
+        return 1;
+    }
+
+    /* Partitions are searched one per thread, like in 'cmd_dump' */
+    bool success;
+    if (table.type == PARTITION_TABLE_NONE)
+        success = find_run(stdout, &disk, &query);
+    else
+        success = partitions_run_parallel(stdout, &disk, &table, find_worker,
+                                          &query);
+
+    if (!success)
+        ERR("Could not search '%s'.", diskimg_path);
+
+    free_partition_table(&table);
+    disk_close(&disk);
+    find_free_query(&query);
+    return success ? 0 : 1;
+}
+
+/*
+ * Print the owner of the specified sector, and the offset of the sector inside
+ * it. Returns false if the LBA is not a valid number.
+ */
+static bool print_lba_owner(const SectorMap* map, const char* lba_str) {
+    /* Unlike 'strtoull', don't accept signs or leading spaces */
+    if (!isdigit((unsigned char)lba_str[0])) {
+        ERR("Invalid LBA: '%s'", lba_str);
+        return false;
+    }
+
+    char* endptr;
+    errno              = 0;
+    const uint64_t lba = strtoull(lba_str, &endptr, 10);
+    if (errno != 0 || *endptr != '\0') {
+        ERR("Invalid LBA: '%s'", lba_str);
+        return false;
+    }
+
+    const SectorExtent* extent = sectormap_lookup(map, lba);
+    if (extent == NULL) {
+        printf("%" PRIu64 " <outside of the volume>\n", lba);
+        return true;
+    }
+
+    const uint64_t offset =
+      extent->offset + (lba - extent->start_lba) * SECTORMAP_SECTOR_SIZE;
+    printf("%" PRIu64 " %s %" PRIu64 "\n",
+           lba,
+           sectormap_owner(map, extent),
+           offset);
+    return true;
+}
+
+static int cmd_lba(const char* self, int argc, char** argv) {
+    if (argc < 2) {
+        ERR("Usage: %s lba DISK.img [LBA...]", self);
+        return 1;
+    }
+
+    const char* diskimg_path = argv[1];
+    Disk disk, volume;
+    if (!open_volume(&disk, &volume, diskimg_path))
+        return 1;
+
+    SectorMap map;
+    if (!sectormap_build(&map, &volume)) {
+        ERR("Could not read the cluster chains of '%s'.", diskimg_path);
+        disk_close(&disk);
+        return 1;
+    }
+
+    /* Without arguments, the LBAs are read from the standard input */
+    int exit_code = 0;
+    if (argc > 2) {
+        for (int i = 2; i < argc; i++)
+            if (!print_lba_owner(&map, argv[i]))
+                exit_code = 1;
+    } else {
+        char token[32];
+        while (scanf("%31s", token) == 1)
+            if (!print_lba_owner(&map, token))
+                exit_code = 1;
+    }
+
+    sectormap_free(&map);
+    disk_close(&disk);
+    return exit_code;
+}
+
+static const Command commands[] = {
+    { "diff", cmd_diff },
+    { "index", cmd_index },
+    { "export", cmd_export },
+    { "pack", cmd_pack },
+    { "defrag", cmd_defrag },
+    { "find", cmd_find },
+    { "lba", cmd_lba },
+};
+
+int main(int argc, char** argv) {
+    if (argc >= 2 && strcmp(argv[1], "--direct") == 0) {
+        disk_flags |= DISK_DIRECT_IO;
+
+        /* Remove the option, keeping the program name in 'argv[0]' */
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
+    if (argc >= 2)
+        for (size_t i = 0; i < ARRLEN(commands); i++)
+            if (strcmp(argv[1], commands[i].name) == 0)
+                return commands[i].func(argv[0], argc - 1, argv + 1);
+
+    return cmd_dump(argv[0], argc, argv);
+}
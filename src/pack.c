@@ -0,0 +1,841 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Needed for 'copy_file_range', 'lstat' and 'ftruncate' */
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "include/util.h"
+#include "include/fat12.h"
+#include "include/tree.h"
+#include "include/pack.h"
+
+/*
+ * Geometry of the generated images. The sector size is fixed, and the number of
+ * sectors per cluster is the smallest one that fits the files in a FAT12
+ * volume.
+ */
+#define SECTOR_SIZE             512
+#define RESERVED_SECTORS        1
+#define FAT_COUNT               2
+#define MIN_ROOT_ENTRIES        224
+#define MAX_ROOT_ENTRIES        0xFFF0
+#define MAX_SECTORS_PER_CLUSTER 64
+#define MAX_CLUSTERS            4084
+#define MEDIA_DESCRIPTOR        0xF8
+
+/*
+ * Size of the buffer used for writing the image.
+ */
+#define WRITE_BUFFER_SIZE (1024 * 1024)
+
+/*
+ * File or directory of the host that will be stored in the image.
+ */
+typedef struct PackNode {
+    char* host_path;
+    char name[11]; /* Padded with spaces, see 'DirectoryEntry' */
+    bool is_dir;
+    bool read_only;
+    uint32_t size;
+    int64_t mtime;
+
+    struct PackNode* children;
+    size_t child_count;
+
+    /* Contiguous run of clusters, assigned by 'plan_clusters' */
+    uint16_t first_cluster;
+    uint32_t cluster_count;
+} PackNode;
+
+/*
+ * Output file with a big buffer, so the image is written with large
+ * sequential writes.
+ */
+typedef struct {
+    int fd;
+    uint8_t* buffer;
+    size_t used;
+} ImageWriter;
+
+/*----------------------------------------------------------------------------*/
+/* Scanning the host directory */
+
+static void free_node(PackNode* node) {
+    for (size_t i = 0; i < node->child_count; i++)
+        free_node(&node->children[i]);
+    free(node->children);
+    free(node->host_path);
+}
+
+/*
+ * Return true if the specified character can be used in a short name without
+ * changes. See p. 24 of the specification.
+ */
+static bool is_valid_short_char(char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           strchr("!#$%&'()-@^_`{}~", c) != NULL;
+}
+
+/*
+ * Convert the specified host file name into a padded 8.3 name. The 'lossy'
+ * argument is set to true if some information, other than the case, was lost in
+ * the conversion.
+ */
+static void make_short_name(const char* host_name, char* dst, bool* lossy) {
+    memset(dst, ' ', 11);
+    *lossy = false;
+
+    /* Leading dots are not allowed */
+    while (*host_name == '.') {
+        host_name++;
+        *lossy = true;
+    }
+
+    const char* ext = strrchr(host_name, '.');
+    const size_t base_len =
+      (ext == NULL) ? strlen(host_name) : (size_t)(ext - host_name);
+
+    size_t written = 0;
+    for (size_t i = 0; i < base_len; i++) {
+        const char c = (char)toupper((unsigned char)host_name[i]);
+        if (c == ' ' || c == '.') {
+            *lossy = true;
+            continue;
+        }
+        if (written >= 8) {
+            *lossy = true;
+            break;
+        }
+        if (!is_valid_short_char(c))
+            *lossy = true;
+        dst[written++] = is_valid_short_char(c) ? c : '_';
+    }
+
+    if (ext == NULL)
+        return;
+
+    written = 0;
+    for (const char* p = ext + 1; *p != '\0'; p++) {
+        const char c = (char)toupper((unsigned char)*p);
+        if (written >= 3 || c == ' ') {
+            *lossy = true;
+            continue;
+        }
+        if (!is_valid_short_char(c))
+            *lossy = true;
+        dst[8 + written++] = is_valid_short_char(c) ? c : '_';
+    }
+}
+
+static bool is_name_used(const PackNode* nodes,
+                         size_t count,
+                         const char* name) {
+    for (size_t i = 0; i < count; i++)
+        if (memcmp(nodes[i].name, name, 11) == 0)
+            return true;
+    return false;
+}
+
+/*
+ * Assign a unique short name to the node at 'idx', given the names of the
+ * previous nodes. Names that couldn't be converted exactly get a numeric tail
+ * (e.g. "LONGFI~1.TXT"), like in p. 30 of the specification.
+ */
+static bool assign_short_name(PackNode* nodes,
+                              size_t idx,
+                              const char* host_name) {
+    PackNode* node = &nodes[idx];
+
+    bool lossy;
+    make_short_name(host_name, node->name, &lossy);
+    if (node->name[0] == ' ')
+        node->name[0] = '_';
+
+    if (!lossy && !is_name_used(nodes, idx, node->name))
+        return true;
+
+    char base[8];
+    memcpy(base, node->name, sizeof(base));
+
+    for (unsigned n = 1; n < 1000000; n++) {
+        char tail[9];
+        const int tail_len = snprintf(tail, sizeof(tail), "~%u", n);
+
+        /* Keep as much of the base name as possible before the tail */
+        size_t base_len = 8;
+        while (base_len > 0 && base[base_len - 1] == ' ')
+            base_len--;
+        if (base_len > 8 - (size_t)tail_len)
+            base_len = 8 - (size_t)tail_len;
+
+        memset(node->name, ' ', 8);
+        memcpy(node->name, base, base_len);
+        memcpy(&node->name[base_len], tail, (size_t)tail_len);
+
+        if (!is_name_used(nodes, idx, node->name))
+            return true;
+    }
+
+    return false;
+}
+
+static int compare_dirents(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/*
+ * Read the children of the specified directory, recursively. The children are
+ * sorted by name, so the generated images are reproducible.
+ *
+ * The 'depth' is the one of the children, like in 'tree_walk', so every packed
+ * directory can be read back.
+ */
+static bool scan_directory(PackNode* dir, int depth) {
+    if (depth > TREE_DEPTH_MAX) {
+        ERR("Directory '%s' is nested too deeply.", dir->host_path);
+        return false;
+    }
+
+    DIR* dp = opendir(dir->host_path);
+    if (dp == NULL) {
+        ERR("Error opening '%s': %s", dir->host_path, strerror(errno));
+        return false;
+    }
+
+    /* Read all the names first, so they can be sorted */
+    char** names          = NULL;
+    size_t names_count    = 0;
+    size_t names_capacity = 0;
+    bool success          = true;
+
+    struct dirent* ent;
+    while (success && (ent = readdir(dp)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+
+        if (names_count >= names_capacity) {
+            names_capacity = (names_capacity == 0) ? 16 : names_capacity * 2;
+            char** new_names = realloc(names, names_capacity * sizeof(char*));
+            if (new_names == NULL) {
+                success = false;
+                break;
+            }
+            names = new_names;
+        }
+
+        const size_t len   = strlen(ent->d_name) + 1;
+        names[names_count] = malloc(len);
+        if (names[names_count] == NULL) {
+            success = false;
+            break;
+        }
+        memcpy(names[names_count++], ent->d_name, len);
+    }
+    closedir(dp);
+
+    if (success && names_count > 0) {
+        qsort(names, names_count, sizeof(char*), compare_dirents);
+        dir->children = calloc(names_count, sizeof(PackNode));
+        success       = (dir->children != NULL);
+    }
+
+    const size_t dir_len = strlen(dir->host_path);
+    for (size_t i = 0; success && i < names_count; i++) {
+        PackNode* child = &dir->children[dir->child_count];
+
+        const size_t name_len = strlen(names[i]);
+        child->host_path      = malloc(dir_len + 1 + name_len + 1);
+        if (child->host_path == NULL) {
+            success = false;
+            break;
+        }
+        memcpy(child->host_path, dir->host_path, dir_len);
+        child->host_path[dir_len] = '/';
+        memcpy(&child->host_path[dir_len + 1], names[i], name_len + 1);
+
+        struct stat st;
+        if (lstat(child->host_path, &st) != 0) {
+            ERR("Error reading '%s': %s", child->host_path, strerror(errno));
+            free(child->host_path);
+            success = false;
+            break;
+        }
+
+        if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) {
+            ERR("Warning: Ignoring '%s', not a regular file or directory.",
+                child->host_path);
+            free(child->host_path);
+            child->host_path = NULL;
+            continue;
+        }
+
+        if (S_ISREG(st.st_mode) && st.st_size > UINT32_MAX) {
+            ERR("File '%s' is too big for a FAT volume.", child->host_path);
+            free(child->host_path);
+            success = false;
+            break;
+        }
+
+        child->is_dir    = S_ISDIR(st.st_mode);
+        child->read_only = (st.st_mode & S_IWUSR) == 0;
+        child->size      = child->is_dir ? 0 : (uint32_t)st.st_size;
+        child->mtime     = (int64_t)st.st_mtime;
+        dir->child_count++;
+
+        if (!assign_short_name(dir->children,
+                               dir->child_count - 1,
+                               names[i]) ||
+            (child->is_dir && !scan_directory(child, depth + 1)))
+            success = false;
+    }
+
+    for (size_t i = 0; i < names_count; i++)
+        free(names[i]);
+    free(names);
+    return success;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Planning the layout */
+
+/*
+ * Return the number of clusters needed for storing the specified node. The
+ * root directory is stored in its own region, so it doesn't need clusters.
+ */
+static uint32_t get_node_clusters(const PackNode* node,
+                                  bool is_root,
+                                  size_t cluster_bytes) {
+    if (is_root)
+        return 0;
+
+    /* Sub-directories also contain the '.' and '..' entries */
+    const uint64_t bytes = node->is_dir ? (node->child_count + 2) *
+                                            sizeof(DirectoryEntry)
+                                        : node->size;
+    return (uint32_t)((bytes + cluster_bytes - 1) / cluster_bytes);
+}
+
+/*
+ * Return the total number of clusters needed for the whole tree.
+ */
+static uint64_t count_clusters(const PackNode* node,
+                               bool is_root,
+                               size_t cluster_bytes) {
+    uint64_t result = get_node_clusters(node, is_root, cluster_bytes);
+    for (size_t i = 0; i < node->child_count; i++)
+        result += count_clusters(&node->children[i], false, cluster_bytes);
+    return result;
+}
+
+/*
+ * Assign a contiguous run of clusters to every node, in depth-first order.
+ * This is the same order used when writing the data region.
+ */
+static void plan_clusters(PackNode* node,
+                          bool is_root,
+                          size_t cluster_bytes,
+                          uint16_t* next_cluster) {
+    node->cluster_count = get_node_clusters(node, is_root, cluster_bytes);
+    node->first_cluster = (node->cluster_count > 0) ? *next_cluster : 0;
+    *next_cluster += node->cluster_count;
+
+    for (size_t i = 0; i < node->child_count; i++)
+        plan_clusters(&node->children[i], false, cluster_bytes, next_cluster);
+}
+
+/*
+ * Return the number of sectors needed for a 12-bit FAT with the specified
+ * number of data clusters, plus the two reserved entries.
+ */
+static inline uint32_t get_fat_sectors(uint32_t cluster_count) {
+    const uint32_t fat_bytes = ((cluster_count + 2) * 3 + 1) / 2;
+    return (fat_bytes + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+/*
+ * Fill the EBPB of the image, choosing the smallest cluster size that fits the
+ * whole tree.
+ */
+static bool plan_geometry(ExtendedBPB* ebpb,
+                          const PackNode* root,
+                          uint64_t image_size) {
+    size_t root_entries = (root->child_count + 15) & ~(size_t)15;
+    if (root_entries < MIN_ROOT_ENTRIES)
+        root_entries = MIN_ROOT_ENTRIES;
+    if (root_entries > MAX_ROOT_ENTRIES) {
+        ERR("Too many files in the root directory.");
+        return false;
+    }
+    const uint32_t root_sectors =
+      (uint32_t)(root_entries * sizeof(DirectoryEntry) / SECTOR_SIZE);
+
+    for (uint32_t spc = 1; spc <= MAX_SECTORS_PER_CLUSTER; spc *= 2) {
+        uint64_t needed = count_clusters(root, true, spc * SECTOR_SIZE);
+        if (needed == 0)
+            needed = 1;
+
+        uint64_t total_sectors;
+        uint32_t fat_sectors;
+        uint64_t cluster_count;
+        if (image_size == 0) {
+            if (needed > MAX_CLUSTERS)
+                continue;
+            cluster_count = needed;
+            fat_sectors   = get_fat_sectors((uint32_t)cluster_count);
+            total_sectors = RESERVED_SECTORS + FAT_COUNT * fat_sectors +
+                            root_sectors + cluster_count * spc;
+        } else {
+            /* The FAT is sized for the maximum number of clusters */
+            total_sectors = image_size / SECTOR_SIZE;
+            const uint64_t max_clusters =
+              (total_sectors > RESERVED_SECTORS + root_sectors)
+                ? (total_sectors - RESERVED_SECTORS - root_sectors) / spc
+                : 0;
+            /* Too many clusters even without the FATs, try bigger ones */
+            if (max_clusters > MAX_CLUSTERS * 2)
+                continue;
+            fat_sectors = get_fat_sectors((uint32_t)max_clusters);
+
+            const uint64_t data_start =
+              RESERVED_SECTORS + FAT_COUNT * fat_sectors + root_sectors;
+            if (total_sectors <= data_start)
+                break;
+            cluster_count = (total_sectors - data_start) / spc;
+            if (cluster_count > MAX_CLUSTERS)
+                continue;
+            if (cluster_count < needed)
+                break;
+        }
+
+        if (total_sectors > UINT32_MAX)
+            break;
+
+        ebpb->bytes_per_sector      = SECTOR_SIZE;
+        ebpb->sectors_per_cluster   = (uint8_t)spc;
+        ebpb->reserved_sectors      = RESERVED_SECTORS;
+        ebpb->fat_count             = FAT_COUNT;
+        ebpb->dir_entries_count     = (uint16_t)root_entries;
+        ebpb->total_sectors         = (total_sectors <= UINT16_MAX)
+                                        ? (uint16_t)total_sectors
+                                        : 0;
+        ebpb->large_sector_count    = (total_sectors <= UINT16_MAX)
+                                        ? 0
+                                        : (uint32_t)total_sectors;
+        ebpb->media_descriptor_type = MEDIA_DESCRIPTOR;
+        ebpb->sectors_per_fat       = (uint16_t)fat_sectors;
+        ebpb->sectors_per_track     = 32;
+        ebpb->heads                 = 64;
+        return true;
+    }
+
+    ERR("The files don't fit in a FAT12 volume%s.",
+        (image_size == 0) ? "" : " of the specified size");
+    return false;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Writing the image */
+
+static bool writer_flush(ImageWriter* writer) {
+    const uint8_t* ptr = writer->buffer;
+    while (writer->used > 0) {
+        const ssize_t written = write(writer->fd, ptr, writer->used);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        ptr += written;
+        writer->used -= (size_t)written;
+    }
+    return true;
+}
+
+static bool writer_write(ImageWriter* writer, const void* data, size_t size) {
+    const uint8_t* ptr = data;
+    while (size > 0) {
+        if (writer->used == WRITE_BUFFER_SIZE && !writer_flush(writer))
+            return false;
+
+        size_t chunk = WRITE_BUFFER_SIZE - writer->used;
+        if (chunk > size)
+            chunk = size;
+
+        if (ptr == NULL)
+            memset(&writer->buffer[writer->used], 0, chunk);
+        else
+            memcpy(&writer->buffer[writer->used], ptr, chunk);
+
+        writer->used += chunk;
+        size -= chunk;
+        if (ptr != NULL)
+            ptr += chunk;
+    }
+    return true;
+}
+
+/*
+ * Write 'size' zero bytes.
+ */
+static inline bool writer_zeros(ImageWriter* writer, size_t size) {
+    return writer_write(writer, NULL, size);
+}
+
+/*
+ * Copy 'size' bytes from the specified host file. The kernel is used for the
+ * copy when possible, otherwise the data goes through the buffer.
+ */
+static bool writer_copy_file(ImageWriter* writer, int fd, size_t size) {
+    if (!writer_flush(writer))
+        return false;
+
+    bool use_kernel = true;
+    while (size > 0) {
+        ssize_t copied = -1;
+        if (use_kernel) {
+            copied = copy_file_range(fd, NULL, writer->fd, NULL, size, 0);
+            if (copied < 0 && errno != EINTR) {
+                use_kernel = false;
+                continue;
+            }
+        } else {
+            size_t chunk = WRITE_BUFFER_SIZE - writer->used;
+            if (chunk > size)
+                chunk = size;
+            copied = read(fd, &writer->buffer[writer->used], chunk);
+            if (copied > 0)
+                writer->used += (size_t)copied;
+            if (writer->used == WRITE_BUFFER_SIZE && !writer_flush(writer))
+                return false;
+        }
+
+        if (copied < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        /* The file is shorter than expected, the rest is filled with zeros */
+        if (copied == 0)
+            return writer_zeros(writer, size);
+
+        size -= (size_t)copied;
+    }
+
+    return true;
+}
+
+static void fill_entry(DirectoryEntry* entry,
+                       const char* name,
+                       uint8_t attributes,
+                       uint16_t first_cluster,
+                       uint32_t size,
+                       int64_t mtime) {
+    memset(entry, 0, sizeof(DirectoryEntry));
+    memcpy(entry->name, name, sizeof(entry->name));
+    entry->attributes        = attributes;
+    entry->first_cluster_low = first_cluster;
+    entry->size              = size;
+
+    uint16_t date, time;
+    unix_to_fat_timestamp(mtime, &date, &time);
+    entry->created_date  = date;
+    entry->created_time  = time;
+    entry->accessed_date = date;
+    entry->modified_date = date;
+    entry->modified_time = time;
+}
+
+/*
+ * Fill the entries for the children of the specified directory.
+ */
+static void fill_children(DirectoryEntry* entries, const PackNode* dir) {
+    for (size_t i = 0; i < dir->child_count; i++) {
+        const PackNode* child = &dir->children[i];
+
+        uint8_t attributes = child->is_dir ? ATTR_DIRECTORY : ATTR_ARCHIVE;
+        if (child->read_only)
+            attributes |= ATTR_READ_ONLY;
+
+        fill_entry(&entries[i],
+                   child->name,
+                   attributes,
+                   child->first_cluster,
+                   child->size,
+                   child->mtime);
+    }
+}
+
+/*
+ * Write the data of the specified node and its children, in the same order
+ * used by 'plan_clusters'.
+ */
+static bool write_node(ImageWriter* writer,
+                       const PackNode* node,
+                       const PackNode* parent,
+                       bool is_root,
+                       size_t cluster_bytes) {
+    const size_t data_bytes = (size_t)node->cluster_count * cluster_bytes;
+
+    if (!is_root && node->is_dir) {
+        DirectoryEntry* entries = calloc(1, data_bytes);
+        if (entries == NULL)
+            return false;
+
+        /* The '..' entry of the root's children points to cluster zero */
+        fill_entry(&entries[0],
+                   ".          ",
+                   ATTR_DIRECTORY,
+                   node->first_cluster,
+                   0,
+                   node->mtime);
+        fill_entry(&entries[1],
+                   "..         ",
+                   ATTR_DIRECTORY,
+                   (parent == NULL) ? 0 : parent->first_cluster,
+                   0,
+                   node->mtime);
+        fill_children(&entries[2], node);
+
+        const bool success = writer_write(writer, entries, data_bytes);
+        free(entries);
+        if (!success)
+            return false;
+    } else if (!node->is_dir) {
+        const int fd = open(node->host_path, O_RDONLY);
+        if (fd < 0) {
+            ERR("Error opening '%s': %s", node->host_path, strerror(errno));
+            return false;
+        }
+
+        const bool success = writer_copy_file(writer, fd, node->size) &&
+                             writer_zeros(writer, data_bytes - node->size);
+        close(fd);
+        if (!success)
+            return false;
+    }
+
+    for (size_t i = 0; i < node->child_count; i++)
+        if (!write_node(writer,
+                        &node->children[i],
+                        is_root ? NULL : node,
+                        false,
+                        cluster_bytes))
+            return false;
+
+    return true;
+}
+
+/*
+ * Set the FAT entries of the run of clusters of the specified node, and of its
+ * children.
+ */
+static void fill_fat_chains(uint16_t* chains, const PackNode* node) {
+    for (uint32_t i = 0; i < node->cluster_count; i++) {
+        const uint16_t cluster = (uint16_t)(node->first_cluster + i);
+        chains[cluster] = (i + 1 < node->cluster_count) ? cluster + 1 : 0xFFF;
+    }
+
+    for (size_t i = 0; i < node->child_count; i++)
+        fill_fat_chains(chains, &node->children[i]);
+}
+
+/*
+ * Encode the whole 12-bit FAT into 'dst', which must be 'sectors_per_fat'
+ * sectors long. See 'fat12_get_linked_cluster' for the layout.
+ */
+static bool encode_fat(uint8_t* dst,
+                       const ExtendedBPB* ebpb,
+                       const PackNode* root) {
+    const size_t entry_count = get_cluster_count(ebpb) + 2;
+    uint16_t* chains         = calloc(entry_count + 1, sizeof(uint16_t));
+    if (chains == NULL)
+        return false;
+
+    /* The first two entries contain the media descriptor and an EOC mark */
+    chains[0] = 0xF00 | ebpb->media_descriptor_type;
+    chains[1] = 0xFFF;
+    fill_fat_chains(chains, root);
+
+    for (size_t i = 0; i < entry_count; i += 2) {
+        const uint16_t even = chains[i];
+        const uint16_t odd  = chains[i + 1];
+        uint8_t* ptr        = &dst[i + i / 2];
+        ptr[0]              = even & 0xFF;
+        ptr[1]              = (uint8_t)((even >> 8) | (odd & 0x0F) << 4);
+        ptr[2]              = (uint8_t)(odd >> 4);
+    }
+
+    free(chains);
+    return true;
+}
+
+static bool write_image(int fd, BootSector* boot_sector, const PackNode* root) {
+    const ExtendedBPB* ebpb    = &boot_sector->ebpb;
+    const size_t cluster_bytes = ebpb->bytes_per_sector *
+                                 ebpb->sectors_per_cluster;
+    const size_t fat_bytes     = ebpb->sectors_per_fat * SECTOR_SIZE;
+    const size_t root_bytes = ebpb->dir_entries_count * sizeof(DirectoryEntry);
+
+    ImageWriter writer = { .fd = fd, .used = 0 };
+    writer.buffer      = malloc(WRITE_BUFFER_SIZE);
+
+    /* One extra byte, since the encoding writes 3 bytes per 2 entries */
+    uint8_t* fat            = calloc(1, fat_bytes + 3);
+    DirectoryEntry* rootdir = calloc(1, root_bytes);
+    bool success = (writer.buffer != NULL && fat != NULL && rootdir != NULL);
+
+    if (success)
+        success = encode_fat(fat, ebpb, root);
+
+    /* The first sector ends with the 0x55AA signature */
+    uint8_t first_sector[SECTOR_SIZE] = { 0 };
+    memcpy(first_sector, boot_sector, sizeof(BootSector));
+    first_sector[510] = 0x55;
+    first_sector[511] = 0xAA;
+
+    if (success)
+        success =
+          writer_write(&writer, first_sector, sizeof(first_sector)) &&
+          writer_zeros(&writer, (RESERVED_SECTORS - 1) * SECTOR_SIZE);
+
+    for (int i = 0; success && i < FAT_COUNT; i++)
+        success = writer_write(&writer, fat, fat_bytes);
+
+    if (success) {
+        fill_children(rootdir, root);
+        success = writer_write(&writer, rootdir, root_bytes) &&
+                  write_node(&writer, root, NULL, true, cluster_bytes) &&
+                  writer_flush(&writer);
+    }
+
+    /* The free clusters at the end are left as a hole in the file */
+    if (success) {
+        const uint64_t total_sectors = (ebpb->total_sectors != 0)
+                                         ? ebpb->total_sectors
+                                         : ebpb->large_sector_count;
+        success = (ftruncate(fd, (off_t)(total_sectors * SECTOR_SIZE)) == 0);
+    }
+
+    free(rootdir);
+    free(fat);
+    free(writer.buffer);
+    return success;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Main function */
+
+/*
+ * Hash the names, sizes and timestamps of the specified tree. Used for the
+ * volume serial number, instead of the current time, so packing the same
+ * directory twice produces the same image.
+ */
+static uint64_t hash_tree(uint64_t hash, const PackNode* node) {
+    hash = hash_fnv1a(hash, node->name, sizeof(node->name));
+    hash = hash_fnv1a(hash, &node->is_dir, sizeof(node->is_dir));
+    hash = hash_fnv1a(hash, &node->size, sizeof(node->size));
+    hash = hash_fnv1a(hash, &node->mtime, sizeof(node->mtime));
+
+    for (size_t i = 0; i < node->child_count; i++)
+        hash = hash_tree(hash, &node->children[i]);
+
+    return hash;
+}
+
+bool pack_directory(const char* src_dir,
+                    const char* image_path,
+                    uint64_t image_size) {
+    struct stat st;
+    if (stat(src_dir, &st) != 0) {
+        ERR("Error opening '%s': %s", src_dir, strerror(errno));
+        return false;
+    }
+
+    PackNode root = { 0 };
+    root.is_dir   = true;
+    root.mtime    = (int64_t)st.st_mtime;
+
+    const size_t src_len = strlen(src_dir);
+    root.host_path       = malloc(src_len + 1);
+    if (root.host_path == NULL)
+        return false;
+    memcpy(root.host_path, src_dir, src_len + 1);
+
+    /* Avoid double slashes in the host paths */
+    for (size_t len = src_len; len > 1 && root.host_path[len - 1] == '/'; len--)
+        root.host_path[len - 1] = '\0';
+
+    BootSector boot_sector;
+    memset(&boot_sector, 0, sizeof(boot_sector));
+
+    bool success = scan_directory(&root, 0) &&
+                   plan_geometry(&boot_sector.ebpb, &root, image_size);
+    if (!success) {
+        free_node(&root);
+        return false;
+    }
+
+    /* Short jump over the EBPB, followed by a NOP */
+    boot_sector.short_jmp = 0x3CEB;
+    boot_sector.nop       = 0x90;
+    memcpy(boot_sector.oem_identifier, "DUMPFAT ", 8);
+
+    ExtendedBPB* ebpb  = &boot_sector.ebpb;
+    ebpb->drive_number = 0x80;
+    ebpb->signature    = 0x29;
+    const uint64_t tree_hash = hash_tree(FNV1A_INIT, &root);
+    const uint32_t volume_id = (uint32_t)(tree_hash ^ (tree_hash >> 32));
+    memcpy(ebpb->volume_id, &volume_id, sizeof(ebpb->volume_id));
+    memcpy(ebpb->volume_label, "NO NAME    ", sizeof(ebpb->volume_label));
+    memcpy(ebpb->system_id, "FAT12   ", sizeof(ebpb->system_id));
+
+    uint16_t next_cluster = 2;
+    plan_clusters(&root,
+                  true,
+                  (size_t)ebpb->bytes_per_sector * ebpb->sectors_per_cluster,
+                  &next_cluster);
+
+    const int fd = open(image_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        ERR("Error opening '%s': %s", image_path, strerror(errno));
+        free_node(&root);
+        return false;
+    }
+
+    success = write_image(fd, &boot_sector, &root);
+    if (close(fd) != 0)
+        success = false;
+
+    free_node(&root);
+    return success;
+}
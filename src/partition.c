@@ -0,0 +1,415 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Needed for 'open_memstream' */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "include/util.h"
+#include "include/disk.h"
+#include "include/fat12.h"
+#include "include/partition.h"
+
+/*
+ * Maximum number of logical partitions that will be read from an extended MBR
+ * partition, and maximum number of GPT entries. Used to avoid loops and huge
+ * allocations in corrupted tables.
+ */
+#define MAX_LOGICAL_PARTITIONS 128
+#define MAX_GPT_ENTRIES        1024
+
+/*
+ * Entry in the partition table of a Master Boot Record (MBR).
+ *
+ * See:
+ * https://en.wikipedia.org/wiki/Master_boot_record#PTE
+ */
+typedef struct {
+    uint8_t status;
+    uint8_t chs_first[3];
+    uint8_t type;
+    uint8_t chs_last[3];
+    uint32_t lba_first;
+    uint32_t sector_count;
+} __attribute__((packed)) MbrEntry;
+STATIC_ASSERT(sizeof(MbrEntry) == 16);
+
+/*
+ * Master Boot Record (MBR), or Extended Boot Record (EBR) of a logical
+ * partition.
+ */
+typedef struct {
+    uint8_t code[446];
+    MbrEntry entries[4];
+    uint8_t signature[2];
+} __attribute__((packed)) Mbr;
+STATIC_ASSERT(sizeof(Mbr) == PARTITION_SECTOR_SIZE);
+
+/*
+ * Header of a GUID Partition Table (GPT), stored in LBA 1.
+ *
+ * See the "Partition table header (LBA 1)" section of:
+ * https://en.wikipedia.org/wiki/GUID_Partition_Table
+ */
+typedef struct {
+    char signature[8];
+    uint32_t revision;
+    uint32_t header_size;
+    uint32_t header_crc32;
+    uint32_t reserved;
+    uint64_t current_lba;
+    uint64_t backup_lba;
+    uint64_t first_usable_lba;
+    uint64_t last_usable_lba;
+    uint8_t disk_guid[16];
+    uint64_t entries_lba;
+    uint32_t entry_count;
+    uint32_t entry_size;
+    uint32_t entries_crc32;
+} __attribute__((packed)) GptHeader;
+STATIC_ASSERT(sizeof(GptHeader) == 92);
+
+/*
+ * Entry in a GUID Partition Table. The 'entry_size' field of the header might
+ * be bigger than this structure.
+ */
+typedef struct {
+    uint8_t type_guid[16];
+    uint8_t unique_guid[16];
+    uint64_t first_lba;
+    uint64_t last_lba;
+    uint64_t attributes;
+    uint16_t name[36];
+} __attribute__((packed)) GptEntry;
+STATIC_ASSERT(sizeof(GptEntry) == 128);
+
+/*
+ * MBR partition types of extended partitions, and of the protective partition
+ * used by GPT disks.
+ */
+#define MBR_TYPE_EXTENDED_CHS 0x05
+#define MBR_TYPE_EXTENDED_LBA 0x0F
+#define MBR_TYPE_EXTENDED_LNX 0x85
+#define MBR_TYPE_GPT          0xEE
+
+/*
+ * Arguments and result of each thread created by 'partitions_run_parallel'.
+ */
+typedef struct {
+    pthread_t thread;
+    bool started;
+
+    const Partition* partition;
+    Disk volume;
+    PartitionWorker worker;
+    void* ctx;
+
+    char* output;
+    size_t output_size;
+    bool result;
+} PartitionJob;
+
+/*----------------------------------------------------------------------------*/
+/* Reading the partition table */
+
+static inline bool is_extended_type(uint8_t type) {
+    return type == MBR_TYPE_EXTENDED_CHS || type == MBR_TYPE_EXTENDED_LBA ||
+           type == MBR_TYPE_EXTENDED_LNX;
+}
+
+/*
+ * Append a partition to the specified table, detecting its file system.
+ */
+static bool push_partition(PartitionTable* table,
+                           const Disk* disk,
+                           const Partition* partition) {
+    Partition* new_arr =
+      realloc(table->arr, (table->size + 1) * sizeof(Partition));
+    if (new_arr == NULL)
+        return false;
+    table->arr = new_arr;
+
+    Partition* dst = &table->arr[table->size++];
+    *dst           = *partition;
+
+    const Disk volume       = get_partition_volume(disk, dst);
+    BootSector* boot_sector = read_boot_sector(&volume);
+    dst->fat_type = (boot_sector == NULL) ? FAT_TYPE_NONE
+                                          : get_fat_type(boot_sector);
+    free(boot_sector);
+    return true;
+}
+
+/*
+ * Read the logical partitions inside the extended partition that starts at
+ * the specified LBA. Each logical partition is preceded by an Extended Boot
+ * Record (EBR), which links to the next one.
+ */
+static bool read_logical_partitions(PartitionTable* table,
+                                    const Disk* disk,
+                                    uint64_t extended_lba) {
+    uint64_t ebr_lba = extended_lba;
+
+    for (uint32_t number = 5; number < 5 + MAX_LOGICAL_PARTITIONS; number++) {
+        Mbr ebr;
+        if (!disk_read(disk,
+                       &ebr,
+                       sizeof(ebr),
+                       ebr_lba * PARTITION_SECTOR_SIZE) ||
+            ebr.signature[0] != 0x55 || ebr.signature[1] != 0xAA)
+            return false;
+
+        /* The first entry is relative to the EBR itself */
+        const MbrEntry* logical = &ebr.entries[0];
+        if (logical->type != 0 && logical->sector_count != 0) {
+            const Partition partition = {
+                .number       = number,
+                .start_lba    = ebr_lba + logical->lba_first,
+                .sector_count = logical->sector_count,
+                .mbr_type     = logical->type,
+            };
+            if (!push_partition(table, disk, &partition))
+                return false;
+        }
+
+        /* The second entry is relative to the extended partition */
+        const MbrEntry* next = &ebr.entries[1];
+        if (!is_extended_type(next->type) || next->lba_first == 0)
+            return true;
+        ebr_lba = extended_lba + next->lba_first;
+    }
+
+    return true;
+}
+
+static bool read_mbr_partitions(PartitionTable* table,
+                                const Disk* disk,
+                                const Mbr* mbr) {
+    for (int i = 0; i < 4; i++) {
+        const MbrEntry* entry = &mbr->entries[i];
+        if (entry->type == 0 || entry->sector_count == 0)
+            continue;
+
+        if (is_extended_type(entry->type)) {
+            if (!read_logical_partitions(table, disk, entry->lba_first))
+                return false;
+            continue;
+        }
+
+        const Partition partition = {
+            .number       = (uint32_t)i + 1,
+            .start_lba    = entry->lba_first,
+            .sector_count = entry->sector_count,
+            .mbr_type     = entry->type,
+        };
+        if (!push_partition(table, disk, &partition))
+            return false;
+    }
+
+    return true;
+}
+
+static bool read_gpt_partitions(PartitionTable* table, const Disk* disk) {
+    GptHeader header;
+    if (!disk_read(disk, &header, sizeof(header), PARTITION_SECTOR_SIZE) ||
+        memcmp(header.signature, "EFI PART", sizeof(header.signature)) != 0 ||
+        header.entry_size < sizeof(GptEntry) ||
+        header.entry_count > MAX_GPT_ENTRIES)
+        return false;
+
+    const size_t table_size = (size_t)header.entry_count * header.entry_size;
+    uint8_t* entries        = malloc(table_size + 1);
+    if (entries == NULL)
+        return false;
+
+    if (!disk_read(disk,
+                   entries,
+                   table_size,
+                   header.entries_lba * PARTITION_SECTOR_SIZE)) {
+        free(entries);
+        return false;
+    }
+
+    static const uint8_t unused_type[16] = { 0 };
+    for (uint32_t i = 0; i < header.entry_count; i++) {
+        const GptEntry* entry =
+          (const GptEntry*)&entries[(size_t)i * header.entry_size];
+        if (memcmp(entry->type_guid, unused_type, sizeof(unused_type)) == 0 ||
+            entry->last_lba < entry->first_lba)
+            continue;
+
+        Partition partition = {
+            .number       = i + 1,
+            .start_lba    = entry->first_lba,
+            .sector_count = entry->last_lba - entry->first_lba + 1,
+        };
+        memcpy(partition.gpt_type, entry->type_guid, sizeof(entry->type_guid));
+
+        if (!push_partition(table, disk, &partition)) {
+            free(entries);
+            return false;
+        }
+    }
+
+    free(entries);
+    return true;
+}
+
+bool read_partition_table(PartitionTable* dst, const Disk* disk) {
+    dst->type = PARTITION_TABLE_NONE;
+    dst->arr  = NULL;
+    dst->size = 0;
+
+    /* Images smaller than a sector can't have a partition table */
+    Mbr mbr;
+    if (!disk_read(disk, &mbr, sizeof(mbr), 0))
+        return true;
+
+    /*
+     * The boot sector of a FAT volume also ends with the 0x55AA signature, so
+     * if the first sector is a valid FAT boot sector, we assume the disk has no
+     * partition table.
+     */
+    if (mbr.signature[0] != 0x55 || mbr.signature[1] != 0xAA ||
+        get_fat_type((const BootSector*)&mbr) != FAT_TYPE_NONE)
+        return true;
+
+    for (int i = 0; i < 4; i++) {
+        const uint8_t status = mbr.entries[i].status;
+        if (status != 0x00 && status != 0x80)
+            return true;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        if (mbr.entries[i].type == MBR_TYPE_GPT) {
+            dst->type = PARTITION_TABLE_GPT;
+            return read_gpt_partitions(dst, disk);
+        }
+    }
+
+    dst->type = PARTITION_TABLE_MBR;
+    return read_mbr_partitions(dst, disk, &mbr);
+}
+
+void free_partition_table(PartitionTable* table) {
+    free(table->arr);
+    table->arr  = NULL;
+    table->size = 0;
+}
+
+Disk get_partition_volume(const Disk* disk, const Partition* partition) {
+    return disk_region(disk,
+                       partition->start_lba * PARTITION_SECTOR_SIZE,
+                       partition->sector_count * PARTITION_SECTOR_SIZE);
+}
+
+bool get_first_volume(Disk* dst, const Disk* disk) {
+    PartitionTable table;
+    if (!read_partition_table(&table, disk))
+        return false;
+
+    if (table.type == PARTITION_TABLE_NONE) {
+        *dst = *disk;
+        return true;
+    }
+
+    bool found = false;
+    for (size_t i = 0; i < table.size && !found; i++) {
+        if (table.arr[i].fat_type == FAT_TYPE_12) {
+            *dst  = get_partition_volume(disk, &table.arr[i]);
+            found = true;
+        }
+    }
+
+    free_partition_table(&table);
+    return found;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Processing partitions in parallel */
+
+static void* partition_thread(void* arg) {
+    PartitionJob* job = arg;
+
+    /* Buffer the output, so it can be printed in order when done */
+    FILE* out = open_memstream(&job->output, &job->output_size);
+    if (out == NULL) {
+        job->result = false;
+        return NULL;
+    }
+
+    job->result = job->worker(out, &job->volume, job->ctx);
+    if (fclose(out) != 0)
+        job->result = false;
+
+    return NULL;
+}
+
+bool partitions_run_parallel(FILE* out,
+                             const Disk* disk,
+                             const PartitionTable* table,
+                             PartitionWorker worker,
+                             void* ctx) {
+    PartitionJob* jobs = calloc(table->size + 1, sizeof(PartitionJob));
+    if (jobs == NULL)
+        return false;
+
+    size_t job_count = 0;
+    for (size_t i = 0; i < table->size; i++) {
+        if (table->arr[i].fat_type != FAT_TYPE_12)
+            continue;
+
+        PartitionJob* job = &jobs[job_count++];
+        job->partition    = &table->arr[i];
+        job->volume       = get_partition_volume(disk, &table->arr[i]);
+        job->worker       = worker;
+        job->ctx          = ctx;
+
+        /* If the thread can't be created, the job is run below */
+        job->started =
+          (pthread_create(&job->thread, NULL, partition_thread, job) == 0);
+    }
+
+    bool success = true;
+    for (size_t i = 0; i < job_count; i++) {
+        PartitionJob* job = &jobs[i];
+        if (job->started)
+            pthread_join(job->thread, NULL);
+        else
+            partition_thread(job);
+
+        fprintf(out, "Partition %" PRIu32 ":\n", job->partition->number);
+        if (job->output != NULL)
+            fwrite(job->output, 1, job->output_size, out);
+        free(job->output);
+
+        if (!job->result)
+            success = false;
+    }
+
+    free(jobs);
+    return success;
+}
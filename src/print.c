@@ -17,11 +17,14 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <inttypes.h>
 #include <stdio.h>
 
 #include "include/util.h"
 #include "include/fat12.h"
+#include "include/dirscan.h"
+#include "include/partition.h"
 
 #define PRINT_MEMBER(FP, STRUCT_PTR, MAXLEN, FMT, MEMBER_NAME)                 \
     fprintf(FP,                                                                \
@@ -64,15 +67,14 @@ void print_ebpb(FILE* fp, const ExtendedBPB* ebpb) {
 }
 
 void print_directory_entries(FILE* fp, const DirectoryEntry* arr, size_t size) {
-    for (size_t i = 0; i < size; i++) {
+    /* The entries after the end-of-directory marker are not printed */
+    size_t end;
+    dirscan_classify(arr, size, 0, NULL, &end);
+
+    for (size_t i = 0; i < end; i++) {
         fprintf(fp, "----------(Entry %03zu)----------\n", i);
         const DirectoryEntry* cur = &arr[i];
 
-        if (is_mem_zero(cur, sizeof(DirectoryEntry))) {
-            fprintf(fp, "<null>\n");
-            continue;
-        }
-
         PRINT_MEMBER(fp, cur, 18, ".11s", name);
         PRINT_MEMBER(fp, cur, 18, PRId8, attributes);
         PRINT_MEMBER(fp, cur, 18, PRId8, reserved);
@@ -87,5 +89,78 @@ void print_directory_entries(FILE* fp, const DirectoryEntry* arr, size_t size) {
         PRINT_MEMBER(fp, cur, 18, PRId32, size);
     }
 
+    if (end < size) {
+        fprintf(fp, "----------(Entry %03zu)----------\n", end);
+        fprintf(fp, "<end of directory, %zu free entries>\n", size - end);
+    }
+
     fprintf(fp, "-------------------------------\n");
 }
+
+void print_cluster_chain(FILE* fp,
+                         const uint16_t* chains,
+                         size_t chain_count,
+                         uint16_t first_cluster) {
+    uint16_t cluster = first_cluster;
+    bool first       = true;
+
+    /* Limit the loop to 'chain_count' clusters, in case there is a cycle */
+    for (size_t i = 0; i < chain_count && fat12_is_data_cluster(cluster) &&
+                       cluster < chain_count;) {
+        /* Find the end of the current contiguous range */
+        const uint16_t range_start = cluster;
+        while (++i < chain_count && (size_t)cluster + 1 < chain_count &&
+               chains[cluster] == cluster + 1)
+            cluster++;
+
+        if (!first)
+            fprintf(fp, ", ");
+        first = false;
+
+        if (cluster == range_start)
+            fprintf(fp, "%" PRIu16, range_start);
+        else
+            fprintf(fp, "%" PRIu16 "-%" PRIu16, range_start, cluster);
+
+        cluster = chains[cluster];
+    }
+
+    if (first)
+        fprintf(fp, "<none>");
+    fputc('\n', fp);
+}
+
+void print_partition_table(FILE* fp, const PartitionTable* table) {
+    const char* type_name = (table->type == PARTITION_TABLE_GPT) ? "GPT"
+                            : (table->type == PARTITION_TABLE_MBR) ? "MBR"
+                                                                    : "None";
+    fprintf(fp, "Partition table: %s\n", type_name);
+    fprintf(fp, "%3s %12s %12s  %-36s  %s\n", "#", "Start", "Sectors", "Type",
+            "File system");
+
+    for (size_t i = 0; i < table->size; i++) {
+        const Partition* partition = &table->arr[i];
+        fprintf(fp,
+                "%3" PRIu32 " %12" PRIu64 " %12" PRIu64 "  ",
+                partition->number,
+                partition->start_lba,
+                partition->sector_count);
+
+        if (table->type == PARTITION_TABLE_GPT) {
+            /*
+             * The first three fields of a GUID are stored in little-endian,
+             * and the last two in big-endian.
+             */
+            const uint8_t* g = partition->gpt_type;
+            fprintf(fp,
+                    "%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-"
+                    "%02X%02X%02X%02X%02X%02X",
+                    g[3], g[2], g[1], g[0], g[5], g[4], g[7], g[6],
+                    g[8], g[9], g[10], g[11], g[12], g[13], g[14], g[15]);
+        } else {
+            fprintf(fp, "0x%02" PRIX8 "%-32s", partition->mbr_type, "");
+        }
+
+        fprintf(fp, "  %s\n", get_fat_type_name(partition->fat_type));
+    }
+}
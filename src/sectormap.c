@@ -0,0 +1,387 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/bytearray.h"
+#include "include/disk.h"
+#include "include/fat12.h"
+#include "include/tree.h"
+#include "include/util.h"
+#include "include/sectormap.h"
+
+/*
+ * State of 'sectormap_build', shared by the tree visitor.
+ */
+typedef struct {
+    SectorMap* map;
+    const ExtendedBPB* ebpb;
+    ByteArray fat;
+    size_t entry_count; /* Number of FAT entries, including the reserved two */
+    bool* used;         /* Clusters reachable from the tree */
+} MapBuilder;
+
+/*----------------------------------------------------------------------------*/
+/* Building */
+
+/*
+ * Append the concatenation of 'str' and 'suffix' to the strings of the map, and
+ * store its offset in 'dst'.
+ */
+static bool add_string(SectorMap* map,
+                       const char* str,
+                       const char* suffix,
+                       size_t* dst) {
+    const size_t str_len    = strlen(str);
+    const size_t suffix_len = strlen(suffix);
+    const size_t size       = str_len + suffix_len + 1;
+
+    if (map->strings_size + size > map->strings_capacity) {
+        size_t new_capacity =
+          (map->strings_capacity == 0) ? 4096 : map->strings_capacity * 2;
+        while (new_capacity < map->strings_size + size)
+            new_capacity *= 2;
+
+        char* new_strings = realloc(map->strings, new_capacity);
+        if (new_strings == NULL)
+            return false;
+        map->strings          = new_strings;
+        map->strings_capacity = new_capacity;
+    }
+
+    *dst = map->strings_size;
+    memcpy(&map->strings[map->strings_size], str, str_len);
+    memcpy(&map->strings[map->strings_size + str_len], suffix, suffix_len + 1);
+    map->strings_size += size;
+    return true;
+}
+
+static bool add_extent(SectorMap* map,
+                       uint64_t start_lba,
+                       uint64_t sector_count,
+                       uint64_t offset,
+                       size_t owner_offset) {
+    if (sector_count == 0)
+        return true;
+
+    if (map->extent_count >= map->extent_capacity) {
+        const size_t new_capacity =
+          (map->extent_capacity == 0) ? 256 : map->extent_capacity * 2;
+        SectorExtent* new_extents =
+          realloc(map->extents, new_capacity * sizeof(SectorExtent));
+        if (new_extents == NULL)
+            return false;
+        map->extents         = new_extents;
+        map->extent_capacity = new_capacity;
+    }
+
+    SectorExtent* extent = &map->extents[map->extent_count++];
+    extent->start_lba    = start_lba;
+    extent->sector_count = sector_count;
+    extent->offset       = offset;
+    extent->owner_offset = owner_offset;
+    return true;
+}
+
+/*
+ * Add an extent for the run of 'count' clusters starting at 'first_cluster'.
+ */
+static bool add_cluster_run(MapBuilder* builder,
+                            uint16_t first_cluster,
+                            size_t count,
+                            uint64_t offset,
+                            size_t owner_offset) {
+    const uint64_t sectors_per_cluster = builder->ebpb->sectors_per_cluster;
+    return add_extent(builder->map,
+                      get_cluster_lba(builder->ebpb, first_cluster),
+                      count * sectors_per_cluster,
+                      offset,
+                      owner_offset);
+}
+
+/*
+ * Add one extent for each run of contiguous clusters in the chain of the
+ * specified entry. Clusters already owned by another chain (i.e. cross-linked
+ * chains) end the chain.
+ */
+static bool sectormap_visit(void* ctx,
+                            const char* path,
+                            const DirectoryEntry* entry) {
+    MapBuilder* builder = ctx;
+
+    if (!fat12_is_data_cluster(entry->first_cluster_low))
+        return true;
+
+    const bool is_dir = (entry->attributes & ATTR_DIRECTORY) != 0;
+    size_t owner_offset;
+    if (!add_string(builder->map, path, is_dir ? "/" : "", &owner_offset))
+        return false;
+
+    const uint64_t cluster_bytes = (uint64_t)builder->ebpb->bytes_per_sector *
+                                   builder->ebpb->sectors_per_cluster;
+
+    uint64_t offset    = 0;
+    uint16_t run_start = 0;
+    size_t run_length  = 0;
+    for (uint16_t cluster = entry->first_cluster_low;
+         fat12_is_data_cluster(cluster) && cluster < builder->entry_count &&
+         !builder->used[cluster];
+         cluster = fat12_get_linked_cluster(builder->fat, cluster)) {
+        builder->used[cluster] = true;
+
+        if (run_length > 0 && cluster == run_start + run_length) {
+            run_length++;
+            continue;
+        }
+
+        if (run_length > 0) {
+            if (!add_cluster_run(builder,
+                                 run_start,
+                                 run_length,
+                                 offset,
+                                 owner_offset))
+                return false;
+            offset += run_length * cluster_bytes;
+        }
+
+        run_start  = cluster;
+        run_length = 1;
+    }
+
+    if (run_length == 0)
+        return true;
+
+    return add_cluster_run(builder, run_start, run_length, offset,
+                           owner_offset);
+}
+
+/*
+ * Kinds of clusters that are not reachable from the tree, depending on their
+ * FAT entry.
+ */
+enum EUnownedKind {
+    UNOWNED_FREE,
+    UNOWNED_BAD,
+    UNOWNED_LOST, /* Allocated in the FAT, but not used by any file */
+};
+
+static const char* const unowned_names[] = {
+    [UNOWNED_FREE] = "<free>",
+    [UNOWNED_BAD]  = "<bad cluster>",
+    [UNOWNED_LOST] = "<lost cluster>",
+};
+
+static enum EUnownedKind get_unowned_kind(ByteArray fat, uint16_t cluster) {
+    const uint16_t value = fat12_get_linked_cluster(fat, cluster);
+    if (value == FAT12_CLUSTER_FREE)
+        return UNOWNED_FREE;
+    if (value == FAT12_CLUSTER_BAD)
+        return UNOWNED_BAD;
+    return UNOWNED_LOST;
+}
+
+/*
+ * Add the extents of the regions that don't belong to files: the reserved
+ * sectors, the FATs, the root directory, and the clusters that are not
+ * reachable from the tree.
+ */
+static bool add_volume_regions(MapBuilder* builder) {
+    SectorMap* map          = builder->map;
+    const ExtendedBPB* ebpb = builder->ebpb;
+
+    size_t name;
+    if (!add_string(map, "<reserved sectors>", "", &name) ||
+        !add_extent(map, 0, ebpb->reserved_sectors, 0, name))
+        return false;
+
+    for (uint8_t i = 0; i < ebpb->fat_count; i++) {
+        char fat_name[32];
+        snprintf(fat_name, sizeof(fat_name), "<FAT %u>", i + 1);
+
+        const uint64_t lba =
+          ebpb->reserved_sectors + (uint64_t)i * ebpb->sectors_per_fat;
+        if (!add_string(map, fat_name, "", &name) ||
+            !add_extent(map, lba, ebpb->sectors_per_fat, 0, name))
+            return false;
+    }
+
+    const size_t rootdir_start = get_rootdir_start(ebpb);
+    const size_t data_start    = get_data_region_start(ebpb);
+    if (!add_string(map, "<root directory>", "", &name) ||
+        !add_extent(map, rootdir_start, data_start - rootdir_start, 0, name))
+        return false;
+
+    /* Sectors after the last cluster, too few for a whole one */
+    const uint64_t total_sectors = (ebpb->total_sectors != 0)
+                                     ? ebpb->total_sectors
+                                     : ebpb->large_sector_count;
+    const uint64_t data_end =
+      data_start +
+      (uint64_t)(builder->entry_count - 2) * ebpb->sectors_per_cluster;
+    if (total_sectors > data_end &&
+        (!add_string(map, "<unused sectors>", "", &name) ||
+         !add_extent(map, data_end, total_sectors - data_end, 0, name)))
+        return false;
+
+    /* Runs of unreachable clusters with the same kind of FAT entry */
+    size_t unowned_offsets[ARRLEN(unowned_names)];
+    for (size_t i = 0; i < ARRLEN(unowned_names); i++)
+        if (!add_string(map, unowned_names[i], "", &unowned_offsets[i]))
+            return false;
+
+    uint16_t cluster = 2;
+    while (cluster < builder->entry_count) {
+        if (builder->used[cluster]) {
+            cluster++;
+            continue;
+        }
+
+        const enum EUnownedKind kind = get_unowned_kind(builder->fat, cluster);
+        size_t count                 = 1;
+        while (cluster + count < builder->entry_count &&
+               !builder->used[cluster + count] &&
+               get_unowned_kind(builder->fat, (uint16_t)(cluster + count)) ==
+                 kind)
+            count++;
+
+        const uint64_t offset = (uint64_t)(cluster - 2) *
+                                ebpb->sectors_per_cluster *
+                                ebpb->bytes_per_sector;
+        if (!add_cluster_run(builder,
+                             cluster,
+                             count,
+                             offset,
+                             unowned_offsets[kind]))
+            return false;
+        cluster = (uint16_t)(cluster + count);
+    }
+
+    return true;
+}
+
+/*
+ * Convert the extents of the map from sectors of the volume, relative to its
+ * start, to 512-byte sectors relative to the start of the image.
+ */
+static void convert_to_image_lbas(SectorMap* map,
+                                  const Disk* disk,
+                                  const ExtendedBPB* ebpb) {
+    const uint64_t base_lba = disk->offset / SECTORMAP_SECTOR_SIZE;
+    const uint64_t scale    = ebpb->bytes_per_sector / SECTORMAP_SECTOR_SIZE;
+
+    for (size_t i = 0; i < map->extent_count; i++) {
+        SectorExtent* extent = &map->extents[i];
+        extent->start_lba    = base_lba + extent->start_lba * scale;
+        extent->sector_count *= scale;
+    }
+}
+
+static int compare_extents(const void* a, const void* b) {
+    const SectorExtent* extent_a = a;
+    const SectorExtent* extent_b = b;
+    if (extent_a->start_lba != extent_b->start_lba)
+        return (extent_a->start_lba < extent_b->start_lba) ? -1 : 1;
+    return 0;
+}
+
+bool sectormap_build(SectorMap* map, const Disk* disk) {
+    memset(map, 0, sizeof(SectorMap));
+
+    BootSector* boot_sector = read_boot_sector(disk);
+    if (boot_sector == NULL)
+        return false;
+
+    const ExtendedBPB* ebpb = &boot_sector->ebpb;
+
+    MapBuilder builder = {
+        .map         = map,
+        .ebpb        = ebpb,
+        .entry_count = get_cluster_count(ebpb) + 2,
+    };
+
+    bool success = false;
+    if (ebpb->bytes_per_sector % SECTORMAP_SECTOR_SIZE != 0 ||
+        disk->offset % SECTORMAP_SECTOR_SIZE != 0) {
+        ERR("Sectors of %u bytes can't be mapped to 512-byte LBAs.",
+            ebpb->bytes_per_sector);
+        goto done;
+    }
+
+    if (!read_fat(&builder.fat, disk, ebpb))
+        goto done;
+
+    builder.used = calloc(builder.entry_count, sizeof(bool));
+    if (builder.used == NULL)
+        goto done;
+
+    success = tree_walk(disk, ebpb, builder.fat, sectormap_visit, &builder) &&
+              add_volume_regions(&builder);
+    if (success) {
+        convert_to_image_lbas(map, disk, ebpb);
+        qsort(map->extents,
+              map->extent_count,
+              sizeof(SectorExtent),
+              compare_extents);
+    }
+
+done:
+    free(builder.used);
+    free(builder.fat.data);
+    free(boot_sector);
+    if (!success)
+        sectormap_free(map);
+    return success;
+}
+
+void sectormap_free(SectorMap* map) {
+    free(map->extents);
+    free(map->strings);
+    map->extents      = NULL;
+    map->strings      = NULL;
+    map->extent_count = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Lookups */
+
+const SectorExtent* sectormap_lookup(const SectorMap* map, uint64_t lba) {
+    /* Find the last extent that starts at or before the LBA */
+    size_t low  = 0;
+    size_t high = map->extent_count;
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        if (map->extents[mid].start_lba <= lba)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (low == 0)
+        return NULL;
+
+    const SectorExtent* extent = &map->extents[low - 1];
+    if (lba - extent->start_lba >= extent->sector_count)
+        return NULL;
+
+    return extent;
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright 2025 8dcc
+ *
+ * This file is part of dump-fat.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "include/bytearray.h"
+#include "include/disk.h"
+#include "include/fat12.h"
+#include "include/dirscan.h"
+#include "include/tree.h"
+#include "include/util.h"
+
+/*
+ * Arguments of 'tree_walk' that are shared by all the recursive calls.
+ */
+typedef struct {
+    const Disk* disk;
+    const ExtendedBPB* ebpb;
+    ByteArray fat;
+    TreeVisitor visitor;
+    void* ctx;
+} TreeWalk;
+
+/*
+ * Visit the 'size' entries in the 'arr' directory, whose path is stored in the
+ * first 'path_len' characters of 'path'.
+ */
+static bool walk_directory(const TreeWalk* walk,
+                           const DirectoryEntry* arr,
+                           size_t size,
+                           char* path,
+                           size_t path_len,
+                           int depth) {
+    /* Deleted entries, LFN entries and volume labels are not reported */
+    DirScan scan;
+    dirscan_init(&scan, arr, size, DIRENT_LIVE);
+
+    const DirectoryEntry* entry;
+    while ((entry = dirscan_next(&scan)) != NULL) {
+        /* Neither are the '.' and '..' entries of sub-directories */
+        if (entry->name[0] == '.')
+            continue;
+
+        char name[ENTRY_NAME_SIZE];
+        get_entry_name(entry, name);
+
+        const size_t name_len = strlen(name);
+        if (path_len + 1 + name_len + 1 > TREE_PATH_MAX)
+            return false;
+
+        path[path_len] = '/';
+        memcpy(&path[path_len + 1], name, name_len + 1);
+        const size_t entry_path_len = path_len + 1 + name_len;
+
+        if (!walk->visitor(walk->ctx, path, entry))
+            return false;
+
+        if ((entry->attributes & ATTR_DIRECTORY) == 0 ||
+            !fat12_is_data_cluster(entry->first_cluster_low))
+            continue;
+
+        /* Skipping it would hide its contents from the callers */
+        if (depth >= TREE_DEPTH_MAX) {
+            ERR("Directory '%s' is nested too deeply.", path);
+            return false;
+        }
+
+        /*
+         * The contents of a sub-directory are stored in a cluster chain, just
+         * like the contents of a regular file.
+         */
+        ByteArray subdir;
+        if (!read_file(&subdir, walk->disk, walk->ebpb, walk->fat, entry))
+            return false;
+
+        const bool success = walk_directory(walk,
+                                            subdir.data,
+                                            subdir.size /
+                                              sizeof(DirectoryEntry),
+                                            path,
+                                            entry_path_len,
+                                            depth + 1);
+        free(subdir.data);
+        if (!success)
+            return false;
+    }
+
+    path[path_len] = '\0';
+    return true;
+}
+
+/*
+ * Convert the path component in the first 'len' characters of 'name' (e.g.
+ * "b.txt") into a padded 8.3 name (e.g. "B       TXT"). Returns false if it
+ * can't be a short name.
+ */
+static bool to_short_name(const char* name, size_t len, char* dst) {
+    memset(dst, ' ', 11);
+
+    size_t base_len = 0;
+    while (base_len < len && name[base_len] != '.')
+        base_len++;
+
+    const size_t ext_len = (base_len < len) ? len - base_len - 1 : 0;
+    if (base_len == 0 || base_len > 8 || ext_len > 3)
+        return false;
+
+    for (size_t i = 0; i < base_len; i++)
+        dst[i] = (char)toupper((unsigned char)name[i]);
+    for (size_t i = 0; i < ext_len; i++)
+        dst[8 + i] = (char)toupper((unsigned char)name[base_len + 1 + i]);
+
+    return true;
+}
+
+bool tree_walk(const Disk* disk,
+               const ExtendedBPB* ebpb,
+               ByteArray fat,
+               TreeVisitor visitor,
+               void* ctx) {
+    return tree_walk_at(disk, ebpb, fat, "/", visitor, ctx);
+}
+
+bool tree_walk_at(const Disk* disk,
+                  const ExtendedBPB* ebpb,
+                  ByteArray fat,
+                  const char* start_path,
+                  TreeVisitor visitor,
+                  void* ctx) {
+    const TreeWalk walk = {
+        .disk    = disk,
+        .ebpb    = ebpb,
+        .fat     = fat,
+        .visitor = visitor,
+        .ctx     = ctx,
+    };
+
+    DirectoryEntry* dir = read_root_directory(disk, ebpb);
+    if (dir == NULL)
+        return false;
+    size_t dir_size = ebpb->dir_entries_count;
+
+    /*
+     * Descend to the starting directory, one component at a time. The path is
+     * rebuilt from the entries, so the visitor receives canonical names.
+     */
+    char path[TREE_PATH_MAX] = "";
+    size_t path_len          = 0;
+    int depth                = 0;
+    for (const char* component = start_path; *component != '\0';) {
+        if (*component == '/') {
+            component++;
+            continue;
+        }
+
+        const size_t component_len = strcspn(component, "/");
+
+        char short_name[11];
+        const DirectoryEntry* entry = NULL;
+        if (to_short_name(component, component_len, short_name))
+            entry = search_entry(dir, dir_size, short_name);
+
+        if (entry == NULL || (entry->attributes & ATTR_DIRECTORY) == 0 ||
+            !fat12_is_data_cluster(entry->first_cluster_low) ||
+            depth >= TREE_DEPTH_MAX) {
+            ERR("Directory '%.*s' not found.",
+                (int)(component - start_path + component_len),
+                start_path);
+            free(dir);
+            return false;
+        }
+
+        char name[ENTRY_NAME_SIZE];
+        get_entry_name(entry, name);
+        const size_t name_len = strlen(name);
+        if (path_len + 1 + name_len + 1 > TREE_PATH_MAX) {
+            free(dir);
+            return false;
+        }
+        path[path_len] = '/';
+        memcpy(&path[path_len + 1], name, name_len + 1);
+        path_len += 1 + name_len;
+
+        ByteArray subdir;
+        const bool success = read_file(&subdir, disk, ebpb, fat, entry);
+        free(dir);
+        if (!success)
+            return false;
+
+        dir       = subdir.data;
+        dir_size  = subdir.size / sizeof(DirectoryEntry);
+        component += component_len;
+        depth++;
+    }
+
+    const bool result =
+      walk_directory(&walk, dir, dir_size, path, path_len, depth);
+    free(dir);
+    return result;
+}
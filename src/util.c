@@ -18,13 +18,15 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "include/util.h"
 
-bool is_mem_zero(const void* ptr, size_t size) {
-    const char* arr = ptr;
-    while (size-- > 0)
-        if (*arr++ != 0)
-            return false;
-    return true;
+uint64_t hash_fnv1a(uint64_t hash, const void* ptr, size_t size) {
+    const uint8_t* arr = ptr;
+    while (size-- > 0) {
+        hash ^= *arr++;
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
 }